@@ -0,0 +1,428 @@
+// Petter Strandmark 2013
+// petter.strandmark@gmail.com
+//
+// Standardized workloads for measuring the speed of the search.
+// Prints one record per measurement in CSV (default) or JSON.
+//
+// Usage: bench [--json] [--quick] [--threads N] [--cores LIST] [--huge-pages]
+//
+// Benchmarks:
+//   playout  Random games from the start position (single thread).
+//   tree     compute_tree from the start position (single thread).
+//   noprefetch  As tree, without software prefetching.
+//   move     compute_move with 1, 2, 4, ..., N threads and a fixed
+//            number of iterations per thread. With --cores, the
+//            threads are pinned to the listed cores (e.g. 0-7,16-23).
+//   socketS  compute_move with one pinned thread per core of socket
+//            S (up to N threads), i.e. the throughput of each socket.
+//   batchB   compute_move with N threads and leaf batches of size
+//            B = 1, 4, 16, 64. The leaves are evaluated with a playout
+//            each plus a fixed cost of 5 us per call, as for a model
+//            evaluated on an accelerator.
+//
+// The hardware counters (cycles, instructions, cache, branch and data
+// TLB misses per iteration) are measured with MCTS::PerfCounters and
+// are -1 where they are not available. When built with PERF_COUNTERS,
+// the tree benchmark is also reported for each phase of the search,
+// as tree_select, tree_expand etc.
+//
+// With --huge-pages, the nodes are allocated on 2 MB pages if the
+// system provides them. Compare dtlb_misses_per_iteration with and
+// without it. This requires building with NODE_POOL, in which case
+// the allocations are not counted.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <mcts.h>
+
+#include "games/connect_four.h"
+#include "games/go.h"
+#include "games/go_5row.h"
+#include "games/kalaha.h"
+#include "games/nim.h"
+
+// Every heap allocation in the program is counted.
+static std::atomic<long long> allocation_count(0);
+
+void* operator new(std::size_t size)
+{
+	allocation_count++;
+	void* ptr = std::malloc(size == 0 ? 1 : size);
+	if (ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+struct BenchmarkResult
+{
+	string game;
+	string benchmark;
+	int threads;
+	long long iterations;
+	double seconds;
+	long long allocations;
+	long long counters[MCTS::PerfCounters::NUMBER_OF_COUNTERS];
+};
+
+class Reporter
+{
+public:
+	Reporter(bool json_)
+		: json(json_), first(true)
+	{
+		if (json) {
+			cout << "[" << endl;
+		}
+		else {
+			cout << "game,benchmark,threads,iterations,seconds,iterations_per_second,allocations_per_iteration";
+			for (int c = 0; c < MCTS::PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+				cout << "," << MCTS::PerfCounters::counter_name(c) << "_per_iteration";
+			}
+			cout << endl;
+		}
+	}
+
+	~Reporter()
+	{
+		if (json) {
+			cout << endl << "]" << endl;
+		}
+	}
+
+	void report(const BenchmarkResult& result)
+	{
+		double per_second = result.iterations / result.seconds;
+		double allocations = per_iteration(result.allocations, result.iterations);
+		if (json) {
+			if ( ! first) {
+				cout << "," << endl;
+			}
+			cout << "  {\"game\": \"" << result.game << "\", "
+			     << "\"benchmark\": \"" << result.benchmark << "\", "
+			     << "\"threads\": " << result.threads << ", "
+			     << "\"iterations\": " << result.iterations << ", "
+			     << "\"seconds\": " << result.seconds << ", "
+			     << "\"iterations_per_second\": " << per_second << ", "
+			     << "\"allocations_per_iteration\": " << allocations;
+			for (int c = 0; c < MCTS::PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+				cout << ", \"" << MCTS::PerfCounters::counter_name(c) << "_per_iteration\": "
+				     << per_iteration(result.counters[c], result.iterations);
+			}
+			cout << "}";
+		}
+		else {
+			cout << result.game << ","
+			     << result.benchmark << ","
+			     << result.threads << ","
+			     << result.iterations << ","
+			     << result.seconds << ","
+			     << per_second << ","
+			     << allocations;
+			for (int c = 0; c < MCTS::PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+				cout << "," << per_iteration(result.counters[c], result.iterations);
+			}
+			cout << endl;
+		}
+		first = false;
+	}
+
+private:
+	// Negative counts are not available and are reported as -1.
+	static double per_iteration(long long count, long long iterations)
+	{
+		return count < 0 ? -1.0 : double(count) / iterations;
+	}
+
+	bool json;
+	bool first;
+};
+
+class Timer
+{
+public:
+	Timer()
+		: start(std::chrono::steady_clock::now()),
+		  start_allocations(allocation_count.load()),
+		  perf_counters(true)
+	{
+		perf_counters.read(start_counts);
+	}
+
+	double seconds() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// The nodes of NODE_POOL builds are not allocated with operator
+	// new, so the allocations are not counted (-1).
+	long long allocations() const
+	{
+		#ifdef MCTS_NODE_POOL
+			return -1;
+		#else
+			return allocation_count.load() - start_allocations;
+		#endif
+	}
+
+	// Counts since the timer was created, or -1 if not available.
+	void counters(long long counts[MCTS::PerfCounters::NUMBER_OF_COUNTERS]) const
+	{
+		unsigned long long end_counts[MCTS::PerfCounters::NUMBER_OF_COUNTERS];
+		perf_counters.read(end_counts);
+		for (int c = 0; c < MCTS::PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+			counts[c] = perf_counters.available(c) ? (long long)(end_counts[c] - start_counts[c]) : -1;
+		}
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+	long long start_allocations;
+	MCTS::PerfCounters perf_counters;
+	unsigned long long start_counts[MCTS::PerfCounters::NUMBER_OF_COUNTERS];
+};
+
+// Returns the cores of each socket according to sysfs. Without
+// topology information, all cores are placed on one socket.
+vector<vector<int>> get_socket_cores()
+{
+	std::map<int, vector<int>> sockets;
+	int cores = std::max(1u, std::thread::hardware_concurrency());
+	for (int core = 0; core < cores; ++core) {
+		int socket = 0;
+		std::ifstream fin("/sys/devices/system/cpu/cpu" + std::to_string(core) + "/topology/physical_package_id");
+		if (fin) {
+			fin >> socket;
+		}
+		sockets[socket].push_back(core);
+	}
+
+	vector<vector<int>> socket_cores;
+	for (auto& socket: sockets) {
+		socket_cores.push_back(socket.second);
+	}
+	return socket_cores;
+}
+
+// Reports one record per phase of the search, with the time split
+// according to the ticks of each phase.
+void report_phases(Reporter* reporter, BenchmarkResult result, const MCTS::SearchStatistics& statistics)
+{
+	double total_ticks = 0;
+	for (int p = 0; p < MCTS::SearchStatistics::NUMBER_OF_PHASES; ++p) {
+		total_ticks += statistics.phase_ticks[p];
+	}
+	auto seconds = result.seconds;
+	auto benchmark = result.benchmark;
+	result.allocations = -1;
+	for (int p = 0; p < MCTS::SearchStatistics::NUMBER_OF_PHASES; ++p) {
+		result.benchmark = benchmark + "_" + MCTS::SearchStatistics::phase_name(p);
+		result.seconds = total_ticks > 0 ? seconds * statistics.phase_ticks[p] / total_ticks : 0;
+		for (int c = 0; c < MCTS::PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+			result.counters[c] = statistics.has_counter[c] ? (long long)(statistics.phase_counters[p][c]) : -1;
+		}
+		reporter->report(result);
+	}
+}
+
+// A PlayoutEvaluator that also spends a fixed time on every call,
+// independent of the number of leaves.
+template<typename State>
+class CallCostEvaluator :
+	public MCTS::LeafEvaluator<State>
+{
+public:
+	explicit CallCostEvaluator(std::chrono::nanoseconds call_cost_)
+		: call_cost(call_cost_)
+	{ }
+
+	virtual void evaluate(const State* states, std::size_t count, double* values)
+	{
+		playouts.evaluate(states, count, values);
+		auto end = std::chrono::steady_clock::now() + call_cost;
+		while (std::chrono::steady_clock::now() < end) { }
+	}
+
+private:
+	const std::chrono::nanoseconds call_cost;
+	MCTS::PlayoutEvaluator<State> playouts;
+};
+
+template<typename State>
+void run_benchmarks(Reporter* reporter,
+                    const string& game,
+                    const State& start_state,
+                    long long playouts,
+                    int iterations,
+                    int max_threads,
+                    const vector<int>& cores,
+                    const vector<vector<int>>& socket_cores)
+{
+	BenchmarkResult result;
+	result.game = game;
+
+	{
+		std::mt19937_64 random_engine(1);
+		Timer timer;
+		for (long long i = 0; i < playouts; ++i) {
+			State state = start_state;
+			while (state.has_moves()) {
+				state.do_random_move(&random_engine);
+			}
+		}
+		result.benchmark = "playout";
+		result.threads = 1;
+		result.iterations = playouts;
+		result.seconds = timer.seconds();
+		result.allocations = timer.allocations();
+		timer.counters(result.counters);
+		reporter->report(result);
+	}
+
+	MCTS::ComputeOptions options;
+	options.max_iterations = iterations;
+
+	for (int prefetch = 1; prefetch >= 0; --prefetch) {
+		options.prefetch = prefetch == 1;
+		MCTS::SearchStatistics statistics;
+		Timer timer;
+		auto root = MCTS::compute_tree(start_state, options, 1, &statistics);
+		result.benchmark = prefetch == 1 ? "tree" : "noprefetch";
+		result.threads = 1;
+		result.iterations = iterations;
+		result.seconds = timer.seconds();
+		result.allocations = timer.allocations();
+		timer.counters(result.counters);
+		reporter->report(result);
+
+		#ifdef MCTS_PERF_COUNTERS
+		if (prefetch == 1) {
+			report_phases(reporter, result, statistics);
+		}
+		#endif
+	}
+	options.prefetch = true;
+
+	options.thread_cores = cores;
+	for (int threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+		options.number_of_threads = threads;
+		Timer timer;
+		MCTS::compute_move(start_state, options);
+		result.benchmark = "move";
+		result.threads = threads;
+		result.iterations = (long long)(iterations) * threads;
+		result.seconds = timer.seconds();
+		result.allocations = timer.allocations();
+		timer.counters(result.counters);
+		reporter->report(result);
+
+		if (threads == max_threads) {
+			break;
+		}
+	}
+
+	for (size_t socket = 0; socket < socket_cores.size(); ++socket) {
+		int threads = std::min(int(socket_cores[socket].size()), max_threads);
+		options.number_of_threads = threads;
+		options.thread_cores = socket_cores[socket];
+		Timer timer;
+		MCTS::compute_move(start_state, options);
+		result.benchmark = "socket" + std::to_string(socket);
+		result.threads = threads;
+		result.iterations = (long long)(iterations) * threads;
+		result.seconds = timer.seconds();
+		result.allocations = timer.allocations();
+		timer.counters(result.counters);
+		reporter->report(result);
+	}
+	options.thread_cores.clear();
+
+	options.number_of_threads = max_threads;
+	for (int batch_size = 1; batch_size <= 64; batch_size *= 4) {
+		options.leaf_batch_size = batch_size;
+		CallCostEvaluator<State> evaluator(std::chrono::microseconds(5));
+		Timer timer;
+		MCTS::compute_move(start_state, options, nullptr, &evaluator);
+		result.benchmark = "batch" + std::to_string(batch_size);
+		result.threads = max_threads;
+		result.iterations = (long long)(iterations) * max_threads;
+		result.seconds = timer.seconds();
+		result.allocations = timer.allocations();
+		timer.counters(result.counters);
+		reporter->report(result);
+	}
+}
+
+int main_program(int argc, char* argv[])
+{
+	bool json = false;
+	int scale = 1;
+	int max_threads = std::max(1u, std::thread::hardware_concurrency());
+	vector<int> cores;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--json") == 0) {
+			json = true;
+		}
+		else if (std::strcmp(argv[i], "--quick") == 0) {
+			scale = 10;
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			max_threads = std::atoi(argv[++i]);
+			attest(max_threads >= 1);
+		}
+		else if (std::strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+			cores = MCTS::parse_core_list(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--huge-pages") == 0) {
+			#ifdef MCTS_NODE_POOL
+				MCTS::NodeMemory::use_huge_pages(true);
+			#else
+				cerr << "--huge-pages requires building with NODE_POOL." << endl;
+				return 1;
+			#endif
+		}
+		else {
+			cerr << "Usage: " << argv[0] << " [--json] [--quick] [--threads N] [--cores LIST] [--huge-pages]" << endl;
+			return 1;
+		}
+	}
+	auto socket_cores = get_socket_cores();
+
+	Reporter reporter(json);
+	run_benchmarks(&reporter, "nim",          NimState(21),           1000000 / scale, 200000 / scale, max_threads, cores, socket_cores);
+	run_benchmarks(&reporter, "connect_four", ConnectFourState(),      200000 / scale, 100000 / scale, max_threads, cores, socket_cores);
+	run_benchmarks(&reporter, "kalaha",       KalahaState<6>(4),       200000 / scale, 100000 / scale, max_threads, cores, socket_cores);
+	run_benchmarks(&reporter, "go",           GoState<5, 5>(),           2000 / scale,   2000 / scale, max_threads, cores, socket_cores);
+	run_benchmarks(&reporter, "go_5row",      Go5RowState<7, 7>(),       1000 / scale,   1000 / scale, max_threads, cores, socket_cores);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		return main_program(argc, argv);
+	}
+	catch (std::runtime_error& error) {
+		std::cerr << "ERROR: " << error.what() << std::endl;
+		return 1;
+	}
+}
@@ -17,20 +17,25 @@ void main_program()
 	MCTS::ComputeOptions player1_options, player2_options;
 	player1_options.max_iterations = 100000;
 	player1_options.verbose = true;
+	// Player 1 searches while the human thinks, for as long as it
+	// takes. Limit the memory of the trees.
+	player1_options.max_memory_bytes = 1LL << 30;
 	player2_options.max_iterations =  10000;
 	player2_options.verbose = true;
 
 	ConnectFourState state;
+	MCTS::Ponderer<ConnectFourState> player1(state, player1_options);
 	while (state.has_moves()) {
 		cout << endl << "State: " << state << endl;
 
 		ConnectFourState::Move move = ConnectFourState::no_move;
 		if (state.player_to_move == 1) {
-			move = MCTS::compute_move(state, player1_options);
+			move = player1.compute_move();
 			state.do_move(move);
 		}
 		else {
 			if (human_player) {
+				player1.start_pondering();
 				while (true) {
 					cout << "Input your move: ";
 					move = ConnectFourState::no_move;
@@ -49,6 +54,7 @@ void main_program()
 				state.do_move(move);
 			}
 		}
+		player1.do_move(move);
 	}
 
 	cout << endl << "Final state: " << state << endl;
@@ -41,7 +41,7 @@ public:
 	}
 
 	template<typename RandomEngine>
-	void do_random_move(RandomEngine* engine)
+	Move do_random_move(RandomEngine* engine)
 	{
 		dattest(has_moves());
 		check_invariant();
@@ -51,7 +51,7 @@ public:
 			auto move = moves(*engine);
 			if (board[0][move] == player_markers[0]) {
 				do_move(move);
-				return;
+				return move;
 			}
 		}
 	}
@@ -165,6 +165,17 @@ public:
 		}
 	}
 
+	std::uint64_t hash() const
+	{
+		auto value = MCTS::hash_combine(MCTS::hash_seed, player_to_move);
+		for (auto& row: board) {
+			for (auto piece: row) {
+				value = MCTS::hash_combine(value, piece);
+			}
+		}
+		return value;
+	}
+
 	void print(ostream& out) const
 	{
 		out << endl;
@@ -188,6 +199,11 @@ public:
 		out << player_markers[player_to_move] << " to move " << endl << endl;
 	}
 
+	int get_num_cols() const
+	{
+		return num_cols;
+	}
+
 	int player_to_move;
 private:
 
@@ -209,3 +225,22 @@ ostream& operator << (ostream& out, const ConnectFourState& state)
 }
 
 const char ConnectFourState::player_markers[3] = {'.', 'X', 'O'}; 
+
+namespace MCTS
+{
+template<>
+struct MoveIndex<ConnectFourState>
+{
+	static const bool is_dense = true;
+
+	static std::size_t size(const ConnectFourState& state)
+	{
+		return state.get_num_cols();
+	}
+
+	static std::size_t index(ConnectFourState::Move move)
+	{
+		return move;
+	}
+};
+}
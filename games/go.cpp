@@ -48,7 +48,7 @@ class GoApp: public AppBasic
 	std::string error_string;
 
 	// Compute move.
-	std::future<State::Move> computed_move;
+	std::unique_ptr<MCTS::SearchSession<State>> search;
 	void next_player();
 	void start_compute_move();
 	void check_for_computed_move();
@@ -104,20 +104,7 @@ void GoApp::start_compute_move()
 		options = player2_options;
 	}
 
-	auto state_copy = state;
-	computed_move = 
-		std::async(std::launch::async,
-			[state_copy, options]() 
-			{ 
-				auto best_move = MCTS::compute_move(state_copy, options);
-				return best_move;
-
-				//// Single-threaded.
-				//auto tree = MCTS::compute_tree(state_copy, options, 1241 * std::time(0));
-				//typedef MCTS::Node<State> Node;
-				//auto best_child = *std::max_element( tree->children.begin(), tree->children.end(), [](Node* lhs, Node* rhs) { return lhs->visits < rhs->visits; } );
-				//return best_child->move;
-			});
+	search.reset(new MCTS::SearchSession<State>(state, options));
 }
 
 void GoApp::check_for_computed_move()
@@ -128,10 +115,10 @@ void GoApp::check_for_computed_move()
 		return;
 	}
 
-	auto status = computed_move.wait_for(std::chrono::seconds(0));
-	if (status == std::future_status::ready) {
+	if ( ! search->is_running()) {
 		try {
-			auto move = computed_move.get();
+			search->wait();
+			auto move = search->best_move_so_far();
 			state.do_move(move);
 
 			// Are there any more moves possible?
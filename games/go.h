@@ -2,8 +2,11 @@
 // petter.strandmark@gmail.com
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <set>
 #include <utility>
+#include <vector>
 
 #include <mcts.h>
 
@@ -48,13 +51,13 @@ public:
 		depth(0),
 		player_to_move(1)
 	{ 
-		all_hash_values.insert(compute_hash_value());
-
 		for (int i = 0; i < M; ++i) {
 			for (int j = 0; j < N; ++j) {
 				board[i][j] =  empty;
 			}
 		}
+
+		all_hash_values.insert(compute_hash_value());
 	}
 
 	GoState(char board[M][N+1]):
@@ -286,13 +289,14 @@ public:
 	}
 
 	template<typename RandomEngine>
-	void do_random_move(RandomEngine* engine)
+	Move do_random_move(RandomEngine* engine)
 	{
 		auto moves = get_moves();
 		attest(! moves.empty());
 		std::uniform_int_distribution<std::size_t> move_ind(0, moves.size() - 1);
 		auto move = moves[move_ind(*engine)];
 		do_move(move);
+		return move;
 	}
 
 	virtual bool has_moves() const
@@ -369,6 +373,27 @@ public:
 		}
 	}
 
+	// Evaluation of an unfinished game from the difference between
+	// the scores. Same meaning as get_result.
+	virtual double evaluate(int current_player_to_move) const
+	{
+		int score = get_player_score(3 - current_player_to_move);
+		int opponent_score = get_player_score(current_player_to_move);
+		return 0.5 + 0.5 * double(score - opponent_score) / (M * N);
+	}
+
+	// Hash of the board and the player to move, for the opening book.
+	// Unlike compute_hash_value, the player to move is included.
+	virtual std::uint64_t hash() const
+	{
+		auto value = MCTS::hash_combine(MCTS::hash_seed, player_to_move);
+		for (int i = 0; i < M; ++i) {
+		for (int j = 0; j < N; ++j) {
+			value = MCTS::hash_combine(value, board[i][j]);
+		}}
+		return value;
+	}
+
 	virtual void dump_board(const char* file_name) const
 	{
 		std::ofstream fout(file_name);
@@ -392,3 +417,23 @@ const typename GoState<M, N>::Move GoState<M, N>::no_move = -2;
 
 template<unsigned int M, unsigned int N>
 const typename GoState<M, N>::Move GoState<M, N>::pass = -1;
+
+namespace MCTS
+{
+// Moves are board positions and pass == -1.
+template<unsigned int M, unsigned int N>
+struct MoveIndex<GoState<M, N>>
+{
+	static const bool is_dense = true;
+
+	static std::size_t size(const GoState<M, N>&)
+	{
+		return M * N + 1;
+	}
+
+	static std::size_t index(typename GoState<M, N>::Move move)
+	{
+		return move + 1;
+	}
+};
+}
@@ -11,11 +11,16 @@ template<unsigned int M, unsigned int N>
 class Go5RowState:
 	public GoState<M, N>
 {
+	typedef GoState<M, N> Base;
+	using Base::board;
+	using Base::empty;
+	using Base::ind_to_ij;
+
 private:
 	int last_row, last_col;
 
-	mutable std::vector<Move> scratch;
 public:
+	typedef typename Base::Move Move;
 
 	Go5RowState():
 		last_row(-1),
@@ -24,7 +29,7 @@ public:
 
 	virtual void do_move(Move move)
 	{
-		GoState::do_move(move);
+		Base::do_move(move);
 		
 		/*
 		if (move == pass) {
@@ -130,7 +135,7 @@ public:
 		if (get_winner() != empty) {
 			return std::vector<Move>();
 		}
-		return GoState::get_moves();
+		return Base::get_moves();
 	}
 
 	virtual double get_result(int current_player_to_move) const
@@ -147,5 +152,18 @@ public:
 			return 1.0;
 		}
 	}
+
+	// The territory of GoState says nothing about five in a row.
+	virtual double evaluate(int current_player_to_move) const
+	{
+		return get_result(current_player_to_move);
+	}
 };
 
+namespace MCTS
+{
+template<unsigned int M, unsigned int N>
+struct MoveIndex<Go5RowState<M, N>> :
+	public MoveIndex<GoState<M, N>>
+{ };
+}
@@ -23,13 +23,18 @@ void main_program()
 	player1_options.max_iterations = -1;
 	player1_options.max_time = 1.0;
 	player1_options.verbose = true;
-	player2_options.max_iterations =  -1;
-	player2_options.max_time = 0.5;
+	// Player 1 searches while the human thinks, for as long as it
+	// takes. Limit the memory of the trees.
+	player1_options.max_memory_bytes = 1LL << 30;
 	player2_options.verbose = true;
+	// Player 2 has 20 seconds for the whole game.
+	MCTS::TimeManager player2_clock(20.0, 0.0, 25);
 
 	typedef KalahaState<6> State;
 	State state(3);
 
+	MCTS::Ponderer<State> player1(state, player1_options);
+
 	stringstream move_string;
 
 	while (state.has_moves()) {
@@ -38,11 +43,12 @@ void main_program()
 
 		State::Move move = State::no_move;
 		if (state.player_to_move == 1) {
-			move = MCTS::compute_move(state, player1_options);
+			move = player1.compute_move();
 			state.do_move(move);
 		}
 		else {
 			if (human_player) {
+				player1.start_pondering();
 				while (true) {
 					cout << "Input your move: ";
 					move = State::no_move;
@@ -57,10 +63,11 @@ void main_program()
 				}
 			}
 			else {
-				move = MCTS::compute_move(state, player2_options);
+				move = MCTS::compute_timed_move(state, player2_options, &player2_clock);
 				state.do_move(move);
 			}
 		}
+		player1.do_move(move);
 
 		move_string << move;
 
@@ -68,6 +75,7 @@ void main_program()
 		// move again in some circumstances.
 		if (state.player_must_pass) {
 			state.do_move(State::pass_move);
+			player1.do_move(State::pass_move);
 			cout << endl << "Player " << state.player_to_move << " goes again.";
 		}
 		else {
@@ -91,11 +91,11 @@ public:
 	}
 
 	template<typename RandomEngine>
-	void do_random_move(RandomEngine* engine)
+	Move do_random_move(RandomEngine* engine)
 	{
 		if (player_must_pass) {
 			do_move(pass_move);
-			return;
+			return pass_move;
 		}
 
 		std::uniform_int_distribution<Move> moves(0, num_bins - 1);
@@ -105,7 +105,7 @@ public:
 			auto move = moves(*engine);
 			if (bins[move] > 0) {
 				do_move(move);
-				return;
+				return move;
 			}
 		}
 	}
@@ -174,6 +174,28 @@ public:
 		}
 	}
 
+	// Evaluation of an unfinished game from the difference between
+	// the stores. Same meaning as get_result.
+	double evaluate(int current_player_to_move) const
+	{
+		double total_seeds = 2 * num_bins * start_seeds;
+		double player1_value = 0.5 + 0.5 * (player1_store - player2_store) / total_seeds;
+		return current_player_to_move == 1 ? 1.0 - player1_value : player1_value;
+	}
+
+	std::uint64_t hash() const
+	{
+		auto value = MCTS::hash_combine(MCTS::hash_seed, player_to_move);
+		value = MCTS::hash_combine(value, player_must_pass);
+		value = MCTS::hash_combine(value, player1_store);
+		value = MCTS::hash_combine(value, player2_store);
+		for (int i = 0; i < num_bins; ++i) {
+			value = MCTS::hash_combine(value, player1_bins[i]);
+			value = MCTS::hash_combine(value, player2_bins[i]);
+		}
+		return value;
+	}
+
 	void collect_seeds()
 	{
 		check_invariant();
@@ -290,3 +312,23 @@ ostream& operator << (ostream& out, const KalahaState<n>& state)
 // See comment at declaration of pass_move.
 template<short num_bins>
 const typename KalahaState<num_bins>::Move KalahaState<num_bins>::pass_move = -1;
+
+namespace MCTS
+{
+// Moves are the bins and pass_move == -1.
+template<short num_bins>
+struct MoveIndex<KalahaState<num_bins>>
+{
+	static const bool is_dense = true;
+
+	static std::size_t size(const KalahaState<num_bins>&)
+	{
+		return num_bins + 1;
+	}
+
+	static std::size_t index(typename KalahaState<num_bins>::Move move)
+	{
+		return move + 1;
+	}
+};
+}
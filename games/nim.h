@@ -30,16 +30,18 @@ public:
 	}
 
 	template<typename RandomEngine>
-	void do_random_move(RandomEngine* engine)
+	Move do_random_move(RandomEngine* engine)
 	{
 		attest(chips > 0);
 		check_invariant();
 
 		int max = std::min(3, chips);
 		std::uniform_int_distribution<Move> moves(1, max);
-		do_move(moves(*engine));
+		auto move = moves(*engine);
+		do_move(move);
 
 		check_invariant();
+		return move;
 	}
 
 	bool has_moves() const
@@ -72,6 +74,11 @@ public:
 		}
 	}
 
+	std::uint64_t hash() const
+	{
+		return MCTS::hash_combine(MCTS::hash_combine(MCTS::hash_seed, chips), player_to_move);
+	}
+
 	int player_to_move;
 private:
 
@@ -83,3 +90,22 @@ private:
 
 	int chips;
 };
+
+namespace MCTS
+{
+template<>
+struct MoveIndex<NimState>
+{
+	static const bool is_dense = true;
+
+	static std::size_t size(const NimState&)
+	{
+		return 4;
+	}
+
+	static std::size_t index(NimState::Move move)
+	{
+		return move;
+	}
+};
+}
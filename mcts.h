@@ -11,6 +11,10 @@
 //
 // Uses the "root parallelization" technique [1].
 //
+// The tree policy is a template parameter of compute_move and
+// compute_tree: UCB1 (UCT, the default, optionally with RAVE [2]),
+// UCB1Tuned [3] or PUCT [4].
+//
 // This game engine can play any game defined by a state like this:
 /*
 
@@ -21,16 +25,29 @@ public:
 	static const Move no_move = ...
 
 	void do_move(Move move);
+	// Returns the move played. Returning void is also supported, but
+	// then RAVE has to fall back to get_moves() during the playouts.
 	template<typename RandomEngine>
-	void do_random_move(*engine);
+	Move do_random_move(*engine);
 	bool has_moves() const;
 	std::vector<Move> get_moves() const;
 
+	// Optional. Prior probability of a move, used by PUCT.
+	double get_prior(const Move& move) const;
+
 	// Returns a value in {0, 0.5, 1}.
 	// This should not be an evaluation function, because it will only be
 	// called for finished games. Return 0.5 to indicate a draw.
 	double get_result(int current_player_to_move) const;
 
+	// Optional. Evaluation of an unfinished game in [0, 1], with the
+	// same meaning as get_result. Required for max_rollout_depth.
+	double evaluate(int current_player_to_move) const;
+
+	// Optional. Hash of the position, required for the opening book.
+	// MCTS::hash_combine can be used to compute it.
+	std::uint64_t hash() const;
+
 	int player_to_move;
 
 	// ...
@@ -40,13 +57,23 @@ private:
 
 */
 //
+// If the moves are small integers, MCTS::MoveIndex may also be
+// specialized for the state (see below).
+//
 // See the examples for more details. Given a suitable State, the
 // following function (tries to) compute the best move for the
-// player to move.
+// player to move. compute_search_result also returns the statistics
+// of the root moves, the principal variation and the cost of the
+// search.
 //
 
+#include <vector>
+
 namespace MCTS
 {
+class OpeningBook;
+class Trace;
+
 struct ComputeOptions
 {
 	int number_of_threads;
@@ -54,17 +81,116 @@ struct ComputeOptions
 	double max_time;
 	bool verbose;
 
+	// Scales the exploration term of the tree policy. The default
+	// sqrt(2) gives the standard UCB1 formula.
+	double exploration_constant;
+
+	// RAVE is blended into the UCT score with weight
+	// sqrt(k / (3n + k)), where n is the number of visits
+	// of the parent and k is the equivalence parameter.
+	bool use_rave;
+	double rave_equivalence;
+
+	// A leaf is only expanded with a new child the n:th time it
+	// is reached. Until then, playouts start from the leaf itself.
+	// Higher values reduce the memory usage of the tree.
+	int expansion_threshold;
+
+	// Approximate memory budget for the search trees of all threads.
+	// When the budget is used up, the trees are no longer expanded
+	// but the search continues with the nodes already allocated.
+	// Negative means no limit.
+	long long max_memory_bytes;
+
+	// If positive, the threads of compute_move publish their root
+	// statistics to each other every sync_interval iterations and
+	// select root moves based on the combined statistics, with the
+	// tree policy (and RAVE) as at the other nodes.
+	int sync_interval;
+
+	// Number of playouts from each leaf reached in the tree. The results
+	// are backpropagated together, which amortizes the cost of the tree
+	// traversal for games with cheap playouts.
+	int playouts_per_leaf;
+
+	// Playouts are stopped after this many moves and the leaf is
+	// scored with State::evaluate instead of the final result.
+	// Negative means that playouts always finish the game.
+	int max_rollout_depth;
+
+	// Number of leaves passed together to a LeafEvaluator. Only used
+	// when an evaluator is given to the search.
+	int leaf_batch_size;
+
+	// Hand the search trees to a background thread for deallocation
+	// (TreeReclaimer) instead of destroying them before returning.
+	bool reclaim_in_background;
+
+	// If not empty, search thread t is pinned to the core
+	// thread_cores[t % thread_cores.size()] (Linux only). The nodes
+	// of a tree are allocated by the thread that grows it, so with
+	// the default first-touch policy they are placed on the NUMA
+	// node of that core. See parse_core_list.
+	std::vector<int> thread_cores;
+
+	// Prefetch the statistics of the selected child while the state
+	// is advanced, and the children ahead of the one being scored.
+	bool prefetch;
+
+	// If set, the searches record a timeline of their threads (see
+	// Trace).
+	Trace* trace;
+
+	// compute_search_result returns the principal variation of this
+	// many root moves (the most visited ones) in addition to the
+	// principal variation of the best move.
+	int multi_pv;
+
+	// If set, the roots of the searches start with the statistics of
+	// the opening book. If the book has at least book_move_visits
+	// visits for the root state, compute_move plays the best book
+	// move without searching. Negative means never.
+	const OpeningBook* opening_book;
+	long long book_move_visits;
+
 	ComputeOptions() :
 		number_of_threads(8),
 		max_iterations(10000),
 		max_time(-1.0), // default is no time limit.
-		verbose(false)
+		verbose(false),
+		exploration_constant(1.4142135623730951), // sqrt(2)
+		use_rave(false),
+		rave_equivalence(1000.0),
+		expansion_threshold(1),
+		max_memory_bytes(-1),
+		sync_interval(0),
+		playouts_per_leaf(1),
+		max_rollout_depth(-1),
+		leaf_batch_size(16),
+		reclaim_in_background(false),
+		prefetch(true),
+		trace(nullptr),
+		multi_pv(1),
+		opening_book(nullptr),
+		book_move_visits(-1)
 	{ }
 };
 
+// Filled in by the search when compiled with MCTS_INSTRUMENTATION.
+struct SearchStatistics;
+
+// The default tree policy.
+struct UCB1;
+
+// Replaces the random playouts with batched evaluations of the leaves.
 template<typename State>
+class LeafEvaluator;
+
+template<typename State, typename Policy = UCB1>
 typename State::Move compute_move(const State root_state,
-                                  const ComputeOptions options = ComputeOptions());
+                                  const ComputeOptions options = ComputeOptions(),
+                                  SearchStatistics* statistics = nullptr,
+                                  LeafEvaluator<State>* evaluator = nullptr);
 }
 //
 //
@@ -72,25 +198,109 @@ typename State::Move compute_move(const State root_state,
 //     Parallel monte-carlo tree search. In Computers and Games (pp.
 //     60-71). Springer Berlin Heidelberg.
 //
+// [2] Gelly, S., & Silver, D. (2007). Combining online and offline
+//     knowledge in UCT. In Proceedings of the 24th International
+//     Conference on Machine Learning (pp. 273-280). ACM.
+//
+// [3] Auer, P., Cesa-Bianchi, N., & Fischer, P. (2002). Finite-time
+//     analysis of the multiarmed bandit problem. Machine Learning,
+//     47(2-3), 235-256.
+//
+// [4] Rosin, C. D. (2011). Multi-armed bandits with episode context.
+//     Annals of Mathematics and Artificial Intelligence, 61(3),
+//     203-230.
+//
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <random>
 #include <set>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #ifdef USE_OPENMP
 #include <omp.h>
 #endif
 
+// Vectorized UCT scoring. Define MCTS_NO_SIMD to use scalar code.
+#ifndef MCTS_NO_SIMD
+	#if defined(__AVX__)
+		#include <immintrin.h>
+		#define MCTS_UCT_AVX
+	#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#include <emmintrin.h>
+		#define MCTS_UCT_SSE2
+	#endif
+#endif
+
+// The opening book is memory-mapped where possible.
+#if defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define MCTS_HAS_MMAP
+#elif defined(_WIN32)
+	#include <malloc.h>
+#endif
+
+// With MCTS_NODE_POOL, the nodes are allocated from per-thread pools
+// of 2 MB chunks (see BlockPool) that can be backed by huge pages.
+// Otherwise they are allocated with new and delete.
+
+// Worker threads can be pinned to cores on Linux.
+#if defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#define MCTS_HAS_AFFINITY
+#endif
+
+// Hardware performance counters (see PerfCounters) are read with
+// perf_event_open on Linux. MCTS_PERF_COUNTERS adds them to the
+// instrumentation of the search.
+#if defined(__linux__)
+	#include <linux/perf_event.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#define MCTS_HAS_PERF_EVENTS
+#endif
+#if defined(MCTS_PERF_COUNTERS) && ! defined(MCTS_INSTRUMENTATION)
+	#define MCTS_INSTRUMENTATION
+#endif
+
+#ifdef MCTS_INSTRUMENTATION
+	#include <chrono>
+	#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		#include <intrin.h>
+		#define MCTS_HAS_RDTSC
+	#elif defined(__x86_64__) || defined(__i386__)
+		#include <x86intrin.h>
+		#define MCTS_HAS_RDTSC
+	#endif
+#endif
+
 namespace MCTS
 {
 using std::cerr;
@@ -108,10 +318,519 @@ static void assertion_failed(const char* expr, const char* file, int line);
 	#define dattest(expr) ((void)0)
 #endif
 
+// Hints that the memory at address will be read soon. Prefetching
+// never faults, so any address (including nullptr) may be given.
+inline void prefetch(const void* address)
+{
+	#if defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(address, 0, 3);
+	#elif defined(MCTS_UCT_AVX) || defined(MCTS_UCT_SSE2)
+		_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+	#else
+		(void)address;
+	#endif
+}
+
+// Number of children ahead of the current one that are prefetched
+// when the policy reads the children while scoring.
+const size_t prefetch_distance = 4;
+
+// Returns the index i maximizing the UCT score
+//
+//   wins[i] / visits[i] + sqrt(exploration / visits[i]),
+//
+// the first one if there are several. statistics contains the pairs
+// (wins[i], visits[i]) after each other. exploration is 2 log(n) for
+// the standard UCT formula, where n is the number of parent visits.
+inline std::size_t uct_argmax(const double* statistics,
+                              std::size_t n,
+                              double exploration)
+{
+	dattest(n > 0);
+	std::size_t best_index = 0;
+	double best_score = -std::numeric_limits<double>::infinity();
+	std::size_t i = 0;
+
+	#if defined(MCTS_UCT_AVX)
+	if (n >= 4) {
+		const __m256d c = _mm256_set1_pd(exploration);
+		const __m256d step = _mm256_set1_pd(4.0);
+		// The unpack instructions work within 128-bit lanes, so the
+		// children are scored in the order 0, 2, 1, 3.
+		__m256d index = _mm256_set_pd(3.0, 1.0, 2.0, 0.0);
+		__m256d lane_best = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+		__m256d lane_best_index = _mm256_setzero_pd();
+		for (; i + 4 <= n; i += 4) {
+			__m256d a = _mm256_loadu_pd(statistics + 2 * i);
+			__m256d b = _mm256_loadu_pd(statistics + 2 * i + 4);
+			__m256d w = _mm256_unpacklo_pd(a, b);
+			__m256d v = _mm256_unpackhi_pd(a, b);
+			__m256d score = _mm256_add_pd(_mm256_div_pd(w, v), _mm256_sqrt_pd(_mm256_div_pd(c, v)));
+			__m256d greater = _mm256_cmp_pd(score, lane_best, _CMP_GT_OQ);
+			lane_best = _mm256_blendv_pd(lane_best, score, greater);
+			lane_best_index = _mm256_blendv_pd(lane_best_index, index, greater);
+			index = _mm256_add_pd(index, step);
+		}
+		double lane_scores[4], lane_indices[4];
+		_mm256_storeu_pd(lane_scores, lane_best);
+		_mm256_storeu_pd(lane_indices, lane_best_index);
+		for (int lane = 0; lane < 4; ++lane) {
+			auto lane_index = std::size_t(lane_indices[lane]);
+			if (lane_scores[lane] > best_score ||
+			    (lane_scores[lane] == best_score && lane_index < best_index)) {
+				best_score = lane_scores[lane];
+				best_index = lane_index;
+			}
+		}
+	}
+	#elif defined(MCTS_UCT_SSE2)
+	if (n >= 2) {
+		const __m128d c = _mm_set1_pd(exploration);
+		const __m128d step = _mm_set1_pd(2.0);
+		__m128d index = _mm_set_pd(1.0, 0.0);
+		__m128d lane_best = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+		__m128d lane_best_index = _mm_setzero_pd();
+		for (; i + 2 <= n; i += 2) {
+			__m128d a = _mm_loadu_pd(statistics + 2 * i);
+			__m128d b = _mm_loadu_pd(statistics + 2 * i + 2);
+			__m128d w = _mm_unpacklo_pd(a, b);
+			__m128d v = _mm_unpackhi_pd(a, b);
+			__m128d score = _mm_add_pd(_mm_div_pd(w, v), _mm_sqrt_pd(_mm_div_pd(c, v)));
+			__m128d greater = _mm_cmpgt_pd(score, lane_best);
+			lane_best = _mm_or_pd(_mm_and_pd(greater, score), _mm_andnot_pd(greater, lane_best));
+			lane_best_index = _mm_or_pd(_mm_and_pd(greater, index), _mm_andnot_pd(greater, lane_best_index));
+			index = _mm_add_pd(index, step);
+		}
+		double lane_scores[2], lane_indices[2];
+		_mm_storeu_pd(lane_scores, lane_best);
+		_mm_storeu_pd(lane_indices, lane_best_index);
+		for (int lane = 0; lane < 2; ++lane) {
+			auto lane_index = std::size_t(lane_indices[lane]);
+			if (lane_scores[lane] > best_score ||
+			    (lane_scores[lane] == best_score && lane_index < best_index)) {
+				best_score = lane_scores[lane];
+				best_index = lane_index;
+			}
+		}
+	}
+	#endif
+
+	for (; i < n; ++i) {
+		double wins = statistics[2 * i];
+		double visits = statistics[2 * i + 1];
+		double score = wins / visits + std::sqrt(exploration / visits);
+		if (score > best_score) {
+			best_score = score;
+			best_index = i;
+		}
+	}
+	return best_index;
+}
+
+// Weight of the all-moves-as-first statistics in RAVE for a node with
+// the given number of visits.
+inline double rave_beta(double rave_equivalence, double visits)
+{
+	return std::sqrt(rave_equivalence / (3.0 * visits + rave_equivalence));
+}
+
+// The value of a child in RAVE: its success rate blended with its
+// all-moves-as-first success rate.
+inline double rave_value(double wins, double visits, double rave_wins, double rave_visits, double beta)
+{
+	double value = wins / visits;
+	if (rave_visits > 0) {
+		value = (1.0 - beta) * value + beta * rave_wins / rave_visits;
+	}
+	return value;
+}
+
+// Large chunks of memory for the node pools (see MCTS_NODE_POOL). The
+// chunks are aligned to their size and start with a header, so that
+// the chunk of any block can be found from its address. Each chunk is
+// allocated and filled by a single thread, which is where first-touch
+// placement puts its memory on NUMA systems.
+class NodeMemory
+{
+public:
+	static const size_t chunk_size = size_t(2) << 20;
+	// Bytes at the start of each chunk used for the header.
+	static const size_t header_size = 64;
+	// NUMA nodes beyond this are reported modulo this number.
+	static const int max_numa_nodes = 64;
+
+	struct ChunkHeader
+	{
+		int numa_node;
+		// How the chunk is returned to the system.
+		int kind;
+		void* allocation;
+		// Blocks in use plus one while a thread allocates from the
+		// chunk. The chunk is freed when this reaches zero.
+		std::atomic<long> references;
+		// Blocks freed by threads other than the one allocating from
+		// the chunk.
+		std::atomic<void*> remote_free;
+	};
+	static_assert(sizeof(ChunkHeader) <= header_size, "The chunk header is too large.");
+
+	// If enabled, chunks allocated from now on are backed by 2 MB
+	// pages: explicit huge pages (hugetlbfs) if any are reserved,
+	// otherwise transparent huge pages via madvise. If neither is
+	// available, ordinary pages are used.
+	static void use_huge_pages(bool enabled)
+	{
+		huge_pages_enabled() = enabled;
+	}
+
+	// Returns a new chunk with an initialized header and one
+	// reference.
+	static ChunkHeader* allocate_chunk()
+	{
+		void* allocation = nullptr;
+		int kind = ORDINARY;
+		void* chunk = nullptr;
+		if (huge_pages_enabled()) {
+			chunk = allocate_huge_chunk(&allocation, &kind);
+		}
+		if (chunk == nullptr) {
+			chunk = allocate_aligned_chunk(&allocation, &kind);
+		}
+		auto header = new (chunk) ChunkHeader;
+		header->numa_node = current_numa_node();
+		header->kind = kind;
+		header->allocation = allocation;
+		header->references = 1;
+		header->remote_free = nullptr;
+		chunks()++;
+		if (kind == HUGE_PAGES) {
+			huge_page_chunks()++;
+		}
+		return header;
+	}
+
+	// Returns a chunk to the system.
+	static void free_chunk(ChunkHeader* header)
+	{
+		chunks()--;
+		if (header->kind == HUGE_PAGES) {
+			huge_page_chunks()--;
+		}
+		void* allocation = header->allocation;
+		header->~ChunkHeader();
+		#if defined(MCTS_HAS_MMAP)
+			::munmap(allocation, chunk_size);
+		#elif defined(_WIN32)
+			::_aligned_free(allocation);
+		#else
+			std::free(allocation);
+		#endif
+	}
+
+	// The header of the chunk containing memory.
+	static ChunkHeader* header_of(const void* memory)
+	{
+		auto chunk = reinterpret_cast<std::uintptr_t>(memory) & ~std::uintptr_t(chunk_size - 1);
+		return reinterpret_cast<ChunkHeader*>(chunk);
+	}
+
+	// The NUMA node of the chunk containing memory.
+	static int numa_node_of(const void* memory)
+	{
+		return header_of(memory)->numa_node;
+	}
+
+	// The NUMA node of the core the calling thread runs on, or 0 if
+	// it can not be determined.
+	static int current_numa_node()
+	{
+		#if defined(MCTS_HAS_AFFINITY) && defined(SYS_getcpu)
+			unsigned cpu = 0;
+			unsigned node = 0;
+			if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+				return int(node % max_numa_nodes);
+			}
+		#endif
+		return 0;
+	}
+
+	// Number of chunks currently allocated, and how many of them are
+	// backed by huge pages.
+	static long long number_of_chunks()
+	{
+		return chunks();
+	}
+
+	static long long number_of_huge_page_chunks()
+	{
+		return huge_page_chunks();
+	}
+
+private:
+	enum ChunkKind {ORDINARY, HUGE_PAGES};
+
+	static std::atomic<bool>& huge_pages_enabled()
+	{
+		static std::atomic<bool> enabled(false);
+		return enabled;
+	}
+
+	static std::atomic<long long>& chunks()
+	{
+		static std::atomic<long long> count(0);
+		return count;
+	}
+
+	static std::atomic<long long>& huge_page_chunks()
+	{
+		static std::atomic<long long> count(0);
+		return count;
+	}
+
+	static bool is_aligned(const void* memory)
+	{
+		return reinterpret_cast<std::uintptr_t>(memory) % chunk_size == 0;
+	}
+
+	// Returns a chunk aligned to chunk_size and stores what to free in
+	// allocation.
+	static void* allocate_aligned_chunk(void** allocation, int* kind)
+	{
+		#if defined(MCTS_HAS_MMAP)
+			// Maps twice the size and unmaps the unaligned ends.
+			auto unaligned = static_cast<char*>(::mmap(nullptr, 2 * chunk_size, PROT_READ | PROT_WRITE,
+			                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+			if (unaligned == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+			auto offset = reinterpret_cast<std::uintptr_t>(unaligned) % chunk_size;
+			auto aligned = unaligned + (offset == 0 ? 0 : chunk_size - offset);
+			if (aligned != unaligned) {
+				::munmap(unaligned, aligned - unaligned);
+			}
+			::munmap(aligned + chunk_size, unaligned + 2 * chunk_size - aligned - chunk_size);
+			*allocation = aligned;
+			*kind = ORDINARY;
+			#if defined(MADV_HUGEPAGE)
+				// Transparent huge pages require the chunk to be aligned.
+				if (huge_pages_enabled() && ::madvise(aligned, chunk_size, MADV_HUGEPAGE) == 0) {
+					*kind = HUGE_PAGES;
+				}
+			#endif
+			return aligned;
+		#elif defined(_WIN32)
+			auto chunk = ::_aligned_malloc(chunk_size, chunk_size);
+			if (chunk == nullptr) {
+				throw std::bad_alloc();
+			}
+			*allocation = chunk;
+			*kind = ORDINARY;
+			return chunk;
+		#else
+			// The pages of the unused part are never touched.
+			auto unaligned = static_cast<char*>(std::malloc(2 * chunk_size));
+			if (unaligned == nullptr) {
+				throw std::bad_alloc();
+			}
+			auto offset = reinterpret_cast<std::uintptr_t>(unaligned) % chunk_size;
+			*allocation = unaligned;
+			*kind = ORDINARY;
+			return unaligned + (offset == 0 ? 0 : chunk_size - offset);
+		#endif
+	}
+
+	// Returns a chunk of explicit huge pages, or nullptr if there are
+	// none.
+	static void* allocate_huge_chunk(void** allocation, int* kind)
+	{
+		#if defined(MCTS_HAS_MMAP) && defined(MAP_HUGETLB)
+			void* memory = ::mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE,
+			                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (memory != MAP_FAILED) {
+				if (is_aligned(memory)) {
+					*allocation = memory;
+					*kind = HUGE_PAGES;
+					return memory;
+				}
+				::munmap(memory, chunk_size);
+			}
+		#endif
+		(void)allocation;
+		(void)kind;
+		return nullptr;
+	}
+};
+
+// Allocates blocks of block_size bytes from chunks of NodeMemory.
+// Each thread allocates from a chunk of its own, so that the blocks
+// are placed on the NUMA node of the thread. Blocks freed by the
+// owning thread are reused right away; blocks freed by other threads
+// are handed back to the owner through a lock-free list in the chunk
+// header. A chunk is returned to the system when its last block is
+// freed after its thread has moved on to a new chunk.
+template<size_t block_size>
+class BlockPool
+{
+public:
+	static void* allocate()
+	{
+		auto& cache = get_cache();
+		if (cache.free_blocks == nullptr) {
+			cache.refill();
+		}
+		auto block = cache.free_blocks;
+		cache.free_blocks = block->next;
+		cache.chunk->references.fetch_add(1, std::memory_order_relaxed);
+		return block;
+	}
+
+	static void deallocate(void* memory)
+	{
+		auto& cache = get_cache();
+		auto block = static_cast<FreeBlock*>(memory);
+		auto header = NodeMemory::header_of(block);
+		if (header == cache.chunk) {
+			// The reference of the thread keeps the chunk alive.
+			block->next = cache.free_blocks;
+			cache.free_blocks = block;
+			header->references.fetch_sub(1, std::memory_order_relaxed);
+			return;
+		}
+		void* head = header->remote_free.load(std::memory_order_relaxed);
+		do {
+			block->next = static_cast<FreeBlock*>(head);
+		} while ( ! header->remote_free.compare_exchange_weak(head, block,
+		                                                      std::memory_order_release,
+		                                                      std::memory_order_relaxed));
+		release(header);
+	}
+
+private:
+	static_assert(block_size >= sizeof(void*), "Blocks must hold a pointer.");
+	static_assert(block_size % sizeof(void*) == 0, "Blocks must be aligned.");
+
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	static void release(NodeMemory::ChunkHeader* header)
+	{
+		if (header->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			NodeMemory::free_chunk(header);
+		}
+	}
+
+	struct Cache
+	{
+		Cache()
+			: chunk(nullptr),
+			  free_blocks(nullptr),
+			  region(nullptr),
+			  region_size(0)
+		{ }
+
+		~Cache()
+		{
+			if (chunk != nullptr) {
+				release(chunk);
+			}
+			chunk = nullptr;
+			free_blocks = nullptr;
+		}
+
+		// Takes the blocks freed by other threads, a new block from
+		// the rest of the chunk or a new chunk.
+		void refill()
+		{
+			if (chunk != nullptr) {
+				free_blocks = static_cast<FreeBlock*>(chunk->remote_free.exchange(nullptr, std::memory_order_acquire));
+				if (free_blocks != nullptr) {
+					return;
+				}
+				if (region_size < block_size) {
+					// Blocks in use keep the chunk alive.
+					release(chunk);
+					chunk = nullptr;
+				}
+			}
+			if (chunk == nullptr) {
+				chunk = NodeMemory::allocate_chunk();
+				// Blocks are aligned to 16 bytes after the header.
+				region = reinterpret_cast<char*>(chunk) + NodeMemory::header_size;
+				region_size = NodeMemory::chunk_size - NodeMemory::header_size;
+			}
+			free_blocks = reinterpret_cast<FreeBlock*>(region);
+			free_blocks->next = nullptr;
+			region += block_size;
+			region_size -= block_size;
+		}
+
+		NodeMemory::ChunkHeader* chunk;
+		FreeBlock* free_blocks;
+		char* region;
+		size_t region_size;
+	};
+
+	static Cache& get_cache()
+	{
+		static thread_local Cache cache;
+		return cache;
+	}
+};
+
+// Statistics of a node that only some searches use: the squared
+// results for UCB1Tuned, the prior for PUCT and the all-moves-as-first
+// statistics for RAVE. They are kept outside the node and allocated
+// only when a search needs them, so that the nodes of the other
+// searches stay small.
+struct PolicyStatistics
+{
+	PolicyStatistics()
+		: wins_squared(0),
+		  prior(1.0),
+		  rave_wins(0),
+		  rave_visits(0)
+	{ }
+
+	static void* operator new(std::size_t size)
+	{
+		#ifdef MCTS_NODE_POOL
+			dattest(size == sizeof(PolicyStatistics));
+			(void)size;
+			return BlockPool<(sizeof(PolicyStatistics) + 15) / 16 * 16>::allocate();
+		#else
+			return ::operator new(size);
+		#endif
+	}
+
+	static void operator delete(void* memory)
+	{
+		#ifdef MCTS_NODE_POOL
+			if (memory != nullptr) {
+				BlockPool<(sizeof(PolicyStatistics) + 15) / 16 * 16>::deallocate(memory);
+			}
+		#else
+			::operator delete(memory);
+		#endif
+	}
+
+	// Sum of the squared results, for the variance.
+	double wins_squared;
+	// Prior probability of the move leading to the node.
+	double prior;
+	// All-moves-as-first statistics.
+	double rave_wins;
+	int rave_visits;
+};
+
 //
 // This class is used to build the game tree. The root is created by the users and
 // the rest of the tree is created by add_node.
 //
+template<typename State>
+class TreeWriter;
+
 template<typename State>
 class Node
 {
@@ -121,6 +840,11 @@ public:
 	Node(const State& state);
 	~Node();
 
+	// Nodes are allocated from a pool with MCTS_NODE_POOL, see
+	// BlockPool.
+	static void* operator new(std::size_t size);
+	static void operator delete(void* memory);
+
 	bool has_untried_moves() const;
 	template<typename RandomEngine>
 	Move get_untried_move(RandomEngine* engine) const;
@@ -131,15 +855,46 @@ public:
 		return ! children.empty();
 	}
 
-	Node* select_child_UCT() const;
+	Node* select_child_UCT(double exploration_constant) const;
+	Node* select_child_RAVE(double rave_equivalence, double exploration_constant, bool prefetch = false) const;
 	Node* add_child(const Move& move, const State& state);
 	void update(double result);
+	// Adds the summed result and summed squared result of count games.
+	void update(double result, int count, double squared_result);
+	void update_rave(double result);
+
+	// The statistics kept in PolicyStatistics. Nodes without them
+	// have a prior of 1 and no squared results or RAVE statistics.
+	double wins_squared() const;
+	double prior() const;
+	double rave_wins() const;
+	int rave_visits() const;
+	void set_prior(double prior);
+	// Allocates the PolicyStatistics of this node, so that update
+	// also sums the squared results from now on.
+	void add_policy_statistics();
+	bool has_policy_statistics() const
+	{
+		return policy_statistics != nullptr;
+	}
+
+	// Removes the child reached by move from this node and returns it
+	// as a new root. Returns nullptr if there is no such child.
+	std::unique_ptr<Node> release_child(const Move& move);
+
+	// Approximate number of bytes used by this node, including the
+	// children pointers it will hold when fully expanded.
+	std::size_t memory_usage() const;
+	// Approximate number of bytes used by the subtree of this node.
+	std::size_t tree_memory_usage() const;
 
+	void print(std::ostream& out) const;
 	std::string to_string() const;
+	// See TreeWriter for writing large trees.
 	std::string tree_to_string(int max_depth = 1000000, int indent = 0) const;
 
 	const Move move;
-	Node* const parent;
+	Node* parent;
 	const int player_to_move;
 
 	//std::atomic<double> wins;
@@ -150,15 +905,19 @@ public:
 	std::vector<Move> moves;
 	std::vector<Node*> children;
 
+	// Copies of the wins and visits of the children, stored
+	// contiguously as (wins, visits) pairs for fast selection.
+	std::vector<double> child_statistics;
+
 private:
 	Node(const State& state, const Move& move, Node* parent);
 
-	std::string indent_string(int indent) const;
-
 	Node(const Node&);
 	Node& operator = (const Node&);
 
-	double UCT_score;
+	std::unique_ptr<PolicyStatistics> policy_statistics;
+	// Position of this node in the children of the parent.
+	int child_index;
 };
 
 
@@ -166,6 +925,30 @@ private:
 /////////////////////////////////////////////////////////
 
 
+template<typename State>
+void* Node<State>::operator new(std::size_t size)
+{
+	#ifdef MCTS_NODE_POOL
+		dattest(size == sizeof(Node));
+		(void)size;
+		return BlockPool<(sizeof(Node) + 15) / 16 * 16>::allocate();
+	#else
+		return ::operator new(size);
+	#endif
+}
+
+template<typename State>
+void Node<State>::operator delete(void* memory)
+{
+	#ifdef MCTS_NODE_POOL
+		if (memory != nullptr) {
+			BlockPool<(sizeof(Node) + 15) / 16 * 16>::deallocate(memory);
+		}
+	#else
+		::operator delete(memory);
+	#endif
+}
+
 template<typename State>
 Node<State>::Node(const State& state) :
 	move(State::no_move),
@@ -174,7 +957,7 @@ Node<State>::Node(const State& state) :
 	wins(0),
 	visits(0),
 	moves(state.get_moves()),
-	UCT_score(0)
+	child_index(-1)
 { }
 
 template<typename State>
@@ -185,14 +968,23 @@ Node<State>::Node(const State& state, const Move& move_, Node* parent_) :
 	wins(0),
 	visits(0),
 	moves(state.get_moves()),
-	UCT_score(0)
+	child_index(int(parent_->children.size()))
 { }
 
 template<typename State>
 Node<State>::~Node()
 {
-	for (auto child: children) {
-		delete child;
+	// The subtree is deleted iteratively, since the trees may be
+	// deeper than the stack allows. Each node is deleted after its
+	// children have been moved to the list.
+	vector<Node*> pending;
+	pending.swap(children);
+	while ( ! pending.empty()) {
+		auto node = pending.back();
+		pending.pop_back();
+		pending.insert(pending.end(), node->children.begin(), node->children.end());
+		node->children.clear();
+		delete node;
 	}
 }
 
@@ -222,23 +1014,50 @@ Node<State>* Node<State>::best_child() const
 }
 
 template<typename State>
-Node<State>* Node<State>::select_child_UCT() const
+Node<State>* Node<State>::select_child_UCT(double exploration_constant) const
 {
 	attest( ! children.empty() );
-	for (auto child: children) {
-		child->UCT_score = double(child->wins) / double(child->visits) +
-			std::sqrt(2.0 * std::log(double(this->visits)) / child->visits);
-	}
+	double exploration = exploration_constant * exploration_constant * std::log(double(this->visits));
+	return children[uct_argmax(child_statistics.data(), children.size(), exploration)];
+}
 
-	return *std::max_element(children.begin(), children.end(),
-		[](Node* a, Node* b) { return a->UCT_score < b->UCT_score; });
+template<typename State>
+Node<State>* Node<State>::select_child_RAVE(double rave_equivalence, double exploration_constant, bool prefetch) const
+{
+	attest( ! children.empty() );
+	double beta = rave_beta(rave_equivalence, this->visits);
+	double exploration = exploration_constant * exploration_constant * std::log(double(this->visits));
+	Node* best_child = nullptr;
+	double best_score = 0;
+	for (size_t c = 0; c < children.size(); ++c) {
+		if (prefetch && c + prefetch_distance < children.size()) {
+			MCTS::prefetch(children[c + prefetch_distance]);
+		}
+		auto child = children[c];
+		double child_wins = child_statistics[2 * c];
+		double child_visits = child_statistics[2 * c + 1];
+		double score = rave_value(child_wins, child_visits, child->rave_wins(), child->rave_visits(), beta) +
+		               std::sqrt(exploration / child_visits);
+		if (best_child == nullptr || score > best_score) {
+			best_child = child;
+			best_score = score;
+		}
+	}
+	return best_child;
 }
 
 template<typename State>
 Node<State>* Node<State>::add_child(const Move& move, const State& state)
 {
+	if (children.empty()) {
+		// Allocate room for all children at once.
+		children.reserve(moves.size());
+		child_statistics.reserve(2 * moves.size());
+	}
 	auto node = new Node(state, move, this);
 	children.push_back(node);
+	child_statistics.push_back(0);
+	child_statistics.push_back(0);
 	attest( ! children.empty());
 
 	auto itr = moves.begin();
@@ -252,104 +1071,2265 @@ Node<State>* Node<State>::add_child(const Move& move, const State& state)
 template<typename State>
 void Node<State>::update(double result)
 {
-	visits++;
+	update(result, 1, result * result);
+}
+
+template<typename State>
+void Node<State>::update(double result, int count, double squared_result)
+{
+	visits += count;
 
 	wins += result;
+	if (policy_statistics) {
+		policy_statistics->wins_squared += squared_result;
+	}
+	if (parent != nullptr) {
+		parent->child_statistics[2 * child_index]     += result;
+		parent->child_statistics[2 * child_index + 1] += count;
+	}
 	//double my_wins = wins.load();
 	//while ( ! wins.compare_exchange_strong(my_wins, my_wins + result));
 }
 
 template<typename State>
-std::string Node<State>::to_string() const
+void Node<State>::update_rave(double result)
 {
-	std::stringstream sout;
-	sout << "["
-	     << "P" << 3 - player_to_move << " "
-	     << "M:" << move << " "
-	     << "W/V: " << wins << "/" << visits << " "
-	     << "U: " << moves.size() << "]\n";
-	return sout.str();
+	add_policy_statistics();
+	policy_statistics->rave_visits++;
+	policy_statistics->rave_wins += result;
 }
 
 template<typename State>
-std::string Node<State>::tree_to_string(int max_depth, int indent) const
+double Node<State>::wins_squared() const
 {
-	if (indent >= max_depth) {
-		return "";
-	}
-
-	std::string s = indent_string(indent) + to_string();
-	for (auto child: children) {
-		s += child->tree_to_string(max_depth, indent + 1);
-	}
-	return s;
+	return policy_statistics ? policy_statistics->wins_squared : 0.0;
 }
 
 template<typename State>
-std::string Node<State>::indent_string(int indent) const
+double Node<State>::prior() const
 {
-	std::string s = "";
-	for (int i = 1; i <= indent; ++i) {
-		s += "| ";
-	}
-	return s;
+	return policy_statistics ? policy_statistics->prior : 1.0;
 }
 
-/////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////
+template<typename State>
+double Node<State>::rave_wins() const
+{
+	return policy_statistics ? policy_statistics->rave_wins : 0.0;
+}
 
+template<typename State>
+int Node<State>::rave_visits() const
+{
+	return policy_statistics ? policy_statistics->rave_visits : 0;
+}
 
 template<typename State>
-std::unique_ptr<Node<State>>  compute_tree(const State root_state,
-                                           const ComputeOptions options,
-                                           std::mt19937_64::result_type initial_seed)
+void Node<State>::set_prior(double prior)
 {
-	std::mt19937_64 random_engine(initial_seed);
+	add_policy_statistics();
+	policy_statistics->prior = prior;
+}
 
-	attest(options.max_iterations >= 0 || options.max_time >= 0);
-	if (options.max_time >= 0) {
-		#ifndef USE_OPENMP
-		throw std::runtime_error("ComputeOptions::max_time requires OpenMP.");
-		#endif
+template<typename State>
+void Node<State>::add_policy_statistics()
+{
+	if ( ! policy_statistics) {
+		policy_statistics.reset(new PolicyStatistics);
 	}
-	// Will support more players later.
-	attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
-	auto root = std::unique_ptr<Node<State>>(new Node<State>(root_state));
-
-	#ifdef USE_OPENMP
-	double start_time = ::omp_get_wtime();
-	double print_time = start_time;
-	#endif
+}
 
+template<typename State>
+std::size_t Node<State>::memory_usage() const
+{
+	auto num_children = std::max(children.capacity(), children.size() + moves.size());
+	return sizeof(Node) + (policy_statistics ? sizeof(PolicyStatistics) : 0) +
+	       moves.capacity() * sizeof(Move) +
+	       num_children * (sizeof(Node*) + 2 * sizeof(double));
+}
+
+template<typename State>
+std::size_t Node<State>::tree_memory_usage() const
+{
+	// Iterative, since the trees may be deeper than the stack allows.
+	std::size_t memory = 0;
+	vector<const Node*> pending(1, this);
+	while ( ! pending.empty()) {
+		auto node = pending.back();
+		pending.pop_back();
+		memory += node->memory_usage();
+		pending.insert(pending.end(), node->children.begin(), node->children.end());
+	}
+	return memory;
+}
+
+template<typename State>
+std::unique_ptr<Node<State>> Node<State>::release_child(const Move& move)
+{
+	std::size_t c = 0;
+	for (; c < children.size() && children[c]->move != move; ++c);
+	if (c == children.size()) {
+		return nullptr;
+	}
+
+	std::unique_ptr<Node> child(children[c]);
+	children.erase(children.begin() + c);
+	child_statistics.erase(child_statistics.begin() + 2 * c,
+	                       child_statistics.begin() + 2 * c + 2);
+	for (; c < children.size(); ++c) {
+		children[c]->child_index = int(c);
+	}
+	child->parent = nullptr;
+	child->child_index = -1;
+	return child;
+}
+
+template<typename State>
+void Node<State>::print(std::ostream& out) const
+{
+	out << "["
+	    << "P" << 3 - player_to_move << " "
+	    << "M:" << move << " "
+	    << "W/V: " << wins << "/" << visits << " "
+	    << "U: " << moves.size() << "]\n";
+}
+
+template<typename State>
+std::string Node<State>::to_string() const
+{
+	std::stringstream sout;
+	print(sout);
+	return sout.str();
+}
+
+template<typename State>
+std::string Node<State>::tree_to_string(int max_depth, int indent) const
+{
+	std::stringstream sout;
+	TreeWriter<State> writer(sout);
+	writer.max_depth = max_depth;
+	writer.write(*this, indent);
+	return sout.str();
+}
+
+/////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////
+
+
+// Writes search trees directly to a stream, without recursion, so
+// that trees of any size and depth can be dumped. Nodes deeper than
+// max_depth and subtrees with fewer than minimum_visits visits are
+// skipped. The formats are
+//
+//   TEXT    One line per node, indented by depth (as tree_to_string).
+//   JSON    Nested objects with the node statistics and "children".
+//           Moves are written with operator <<.
+//   BINARY  "MCTSTREE" followed by the nodes in pre-order, each as
+//           int64 move, int32 player to move, int32 visits,
+//           double wins, uint32 untried moves and uint32 children
+//           written. Requires integral moves.
+template<typename State>
+class TreeWriter
+{
+public:
+	enum Format {TEXT, JSON, BINARY};
+
+	TreeWriter(std::ostream& out_, Format format_ = TEXT)
+		: max_depth(std::numeric_limits<int>::max()),
+		  minimum_visits(0),
+		  out(out_),
+		  format(format_)
+	{ }
+
+	// Writes the tree of root. The root is at the given depth, which
+	// counts towards max_depth and the indentation of TEXT.
+	void write(const Node<State>& root, int depth = 0)
+	{
+		if (format == BINARY) {
+			out.write("MCTSTREE", 8);
+		}
+		if (depth >= max_depth) {
+			return;
+		}
+
+		// Null nodes close the JSON object of the given depth.
+		stack.clear();
+		stack.push_back(std::make_pair(&root, depth));
+		first_child.assign(1, true);
+		while ( ! stack.empty()) {
+			auto node = stack.back().first;
+			auto node_depth = stack.back().second;
+			stack.pop_back();
+			if (node == nullptr) {
+				out << "]}";
+				continue;
+			}
+
+			auto first_written_child = stack.size();
+			if (node_depth + 1 < max_depth) {
+				for (auto child = node->children.rbegin(); child != node->children.rend(); ++child) {
+					if ((*child)->visits >= minimum_visits) {
+						stack.push_back(std::make_pair(*child, node_depth + 1));
+					}
+				}
+			}
+			auto number_of_children = stack.size() - first_written_child;
+
+			if (format == TEXT) {
+				for (int i = 0; i < node_depth; ++i) {
+					out << "| ";
+				}
+				node->print(out);
+			}
+			else if (format == JSON) {
+				std::size_t level = node_depth - depth;
+				if ( ! first_child[level]) {
+					out << ",";
+				}
+				first_child[level] = false;
+				first_child.resize(level + 2);
+				first_child[level + 1] = true;
+				out << "{\"move\":" << node->move
+				    << ",\"player\":" << 3 - node->player_to_move
+				    << ",\"wins\":" << node->wins
+				    << ",\"visits\":" << node->visits
+				    << ",\"untried\":" << node->moves.size()
+				    << ",\"children\":[";
+				// The closing marker goes below the children.
+				stack.insert(stack.begin() + first_written_child,
+				             std::make_pair(static_cast<const Node<State>*>(nullptr), node_depth));
+			}
+			else {
+				write_binary(*node, number_of_children,
+				             std::integral_constant<bool, std::is_integral<typename State::Move>::value>());
+			}
+		}
+		if (format == JSON) {
+			out << "\n";
+		}
+	}
+
+	int max_depth;
+	long long minimum_visits;
+
+private:
+	void write_binary(const Node<State>& node, std::size_t number_of_children, std::true_type)
+	{
+		std::int64_t move = node.move;
+		std::int32_t player_to_move = node.player_to_move;
+		std::int32_t visits = node.visits;
+		double wins = node.wins;
+		std::uint32_t untried = std::uint32_t(node.moves.size());
+		std::uint32_t children = std::uint32_t(number_of_children);
+		out.write(reinterpret_cast<const char*>(&move), sizeof(move));
+		out.write(reinterpret_cast<const char*>(&player_to_move), sizeof(player_to_move));
+		out.write(reinterpret_cast<const char*>(&visits), sizeof(visits));
+		out.write(reinterpret_cast<const char*>(&wins), sizeof(wins));
+		out.write(reinterpret_cast<const char*>(&untried), sizeof(untried));
+		out.write(reinterpret_cast<const char*>(&children), sizeof(children));
+	}
+
+	void write_binary(const Node<State>&, std::size_t, std::false_type)
+	{
+		throw std::runtime_error("The binary tree format requires integral moves.");
+	}
+
+	std::ostream& out;
+	Format format;
+	vector<std::pair<const Node<State>*, int>> stack;
+	vector<bool> first_child;
+};
+
+// A timeline of the search threads in the Chrome trace_event format.
+// Load the file written by write in chrome://tracing or Perfetto. The
+// searches record the tree building, merging and destruction of each
+// thread, as well as every iteration_interval:th iteration.
+class Trace
+{
+public:
+	Trace(int iteration_interval_ = 1000)
+		: iteration_interval(iteration_interval_),
+		  start(std::chrono::steady_clock::now())
+	{
+		attest(iteration_interval >= 1);
+	}
+
+	// Microseconds since the trace was created.
+	double now() const
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Records a span of the calling thread.
+	void add_span(const char* name, double begin, double end)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Span span = {name, thread_index(), begin, end};
+		spans.push_back(span);
+	}
+
+	bool is_sampled(int iteration) const
+	{
+		return iteration % iteration_interval == 0;
+	}
+
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return spans.size();
+	}
+
+	void write(std::ostream& out) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		out << "{\"traceEvents\":[";
+		for (size_t t = 0; t < threads.size(); ++t) {
+			out << (t == 0 ? "" : ",")
+			    << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+			    << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+		}
+		auto precision = out.precision(15);
+		for (auto& span: spans) {
+			out << ",\n{\"name\":\"" << span.name << "\",\"cat\":\"mcts\",\"ph\":\"X\",\"pid\":1"
+			    << ",\"tid\":" << span.thread
+			    << ",\"ts\":" << span.begin
+			    << ",\"dur\":" << span.end - span.begin << "}";
+		}
+		out.precision(precision);
+		out << "\n]}\n";
+	}
+
+	void write(const std::string& file_name) const
+	{
+		std::ofstream fout(file_name);
+		write(fout);
+		if ( ! fout) {
+			throw std::runtime_error("Could not write trace " + file_name + ".");
+		}
+	}
+
+	const int iteration_interval;
+
+private:
+	Trace(const Trace&);
+	Trace& operator = (const Trace&);
+
+	struct Span
+	{
+		const char* name;
+		int thread;
+		double begin;
+		double end;
+	};
+
+	// Threads are numbered in the order they first record a span.
+	// The mutex must be held.
+	int thread_index()
+	{
+		auto id = std::this_thread::get_id();
+		auto itr = std::find(threads.begin(), threads.end(), id);
+		if (itr == threads.end()) {
+			threads.push_back(id);
+			return int(threads.size()) - 1;
+		}
+		return int(itr - threads.begin());
+	}
+
+	const std::chrono::steady_clock::time_point start;
+	mutable std::mutex mutex;
+	vector<Span> spans;
+	vector<std::thread::id> threads;
+};
+
+// Records a span of the calling thread from construction to
+// destruction. Does nothing if trace is nullptr.
+class TraceSpan
+{
+public:
+	TraceSpan(Trace* trace_, const char* name_)
+		: trace(trace_),
+		  name(name_),
+		  begin(trace_ != nullptr ? trace_->now() : 0)
+	{ }
+
+	~TraceSpan()
+	{
+		if (trace != nullptr) {
+			trace->add_span(name, begin, trace->now());
+		}
+	}
+
+private:
+	TraceSpan(const TraceSpan&);
+	TraceSpan& operator = (const TraceSpan&);
+
+	Trace* trace;
+	const char* name;
+	double begin;
+};
+
+// Destroys search trees on a background thread, so that the searches
+// can return without waiting for the deallocation of their trees.
+class TreeReclaimer
+{
+public:
+	TreeReclaimer()
+		: stopping(false),
+		  busy(false),
+		  thread(&TreeReclaimer::run, this)
+	{ }
+
+	// Destroys the remaining trees before returning.
+	~TreeReclaimer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_available.notify_one();
+		thread.join();
+	}
+
+	// The reclaimer shared by all searches.
+	static TreeReclaimer& instance()
+	{
+		static TreeReclaimer reclaimer;
+		return reclaimer;
+	}
+
+	template<typename State>
+	void reclaim(std::unique_ptr<Node<State>> root)
+	{
+		if ( ! root) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.emplace_back(new Tree<State>(std::move(root)));
+		}
+		work_available.notify_one();
+	}
+
+	// Waits until all trees reclaimed so far have been destroyed.
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		work_done.wait(lock, [this] { return queue.empty() && ! busy; });
+	}
+
+private:
+	TreeReclaimer(const TreeReclaimer&);
+	TreeReclaimer& operator = (const TreeReclaimer&);
+
+	struct Reclaimable
+	{
+		virtual ~Reclaimable() { }
+	};
+
+	template<typename State>
+	struct Tree : public Reclaimable
+	{
+		Tree(std::unique_ptr<Node<State>> root_) : root(std::move(root_)) { }
+		std::unique_ptr<Node<State>> root;
+	};
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			work_available.wait(lock, [this] { return stopping || ! queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			std::unique_ptr<Reclaimable> tree(std::move(queue.front()));
+			queue.pop_front();
+			busy = true;
+			lock.unlock();
+			tree.reset();
+			lock.lock();
+			busy = false;
+			work_done.notify_all();
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+	std::deque<std::unique_ptr<Reclaimable>> queue;
+	bool stopping;
+	bool busy;
+	std::thread thread;
+};
+
+// Destroys the trees in roots, either in parallel or on the
+// background reclaimer.
+template<typename State>
+void destroy_trees(vector<std::unique_ptr<Node<State>>>* roots, bool in_background, Trace* trace = nullptr)
+{
+	TraceSpan span(trace, "destroy trees");
+	if (in_background) {
+		for (auto& root: *roots) {
+			TreeReclaimer::instance().reclaim(std::move(root));
+		}
+	}
+	else if (roots->size() > 1) {
+		vector<std::future<void>> futures;
+		for (auto& root: *roots) {
+			auto tree = root.release();
+			futures.push_back(std::async(std::launch::async, [tree, trace] ()
+			{
+				TraceSpan span(trace, "destroy tree");
+				delete tree;
+			}));
+		}
+		for (auto& future: futures) {
+			future.get();
+		}
+	}
+	roots->clear();
+}
+
+// Parses a list of cores such as "0-3,8,10-11".
+inline vector<int> parse_core_list(const std::string& list)
+{
+	vector<int> cores;
+	size_t position = 0;
+	while (position < list.size()) {
+		auto end = list.find(',', position);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		auto range = list.substr(position, end - position);
+		auto dash = range.find('-');
+		char* first_end = nullptr;
+		char* last_end = nullptr;
+		auto first = std::strtol(range.c_str(), &first_end, 10);
+		auto last = first;
+		if (dash != std::string::npos) {
+			last = std::strtol(range.c_str() + dash + 1, &last_end, 10);
+		}
+		bool valid = ! range.empty()
+		             && first_end == range.c_str() + (dash == std::string::npos ? range.size() : dash)
+		             && (dash == std::string::npos || last_end == range.c_str() + range.size())
+		             && 0 <= first && first <= last;
+		if ( ! valid) {
+			throw std::runtime_error("Invalid core list: " + list);
+		}
+		for (auto core = first; core <= last; ++core) {
+			cores.push_back(int(core));
+		}
+		position = end + 1;
+	}
+	return cores;
+}
+
+// Pins the calling thread to the core given by options.thread_cores
+// for search thread t. Returns false if the thread was not pinned.
+inline bool pin_search_thread(const ComputeOptions& options, int t)
+{
+	if (options.thread_cores.empty()) {
+		return false;
+	}
+	#ifdef MCTS_HAS_AFFINITY
+		int core = options.thread_cores[t % options.thread_cores.size()];
+		if (core < 0 || core >= CPU_SETSIZE) {
+			return false;
+		}
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(core, &cpu_set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+	#else
+		return false;
+	#endif
+}
+
+inline void print_unpinned_threads(std::ostream& out, int unpinned_threads)
+{
+	if (unpinned_threads > 0) {
+		out << unpinned_threads << " threads could not be pinned to their cores." << std::endl;
+	}
+}
+
+struct MoveStatistics
+{
+	MoveStatistics() : visits(0), wins(0), wins_squared(0), rave_wins(0), rave_visits(0) { }
+	long long visits;
+	double wins;
+	// The statistics of PolicyStatistics, for selecting root moves
+	// from the statistics of several threads.
+	double wins_squared;
+	double rave_wins;
+	long long rave_visits;
+};
+
+// Adds the statistics of other to statistics.
+inline void add_move_statistics(MoveStatistics* statistics, const MoveStatistics& other)
+{
+	statistics->visits       += other.visits;
+	statistics->wins         += other.wins;
+	statistics->wins_squared += other.wins_squared;
+	statistics->rave_wins    += other.rave_wins;
+	statistics->rave_visits  += other.rave_visits;
+}
+
+// Tree policies. A policy selects the child to descend into from a
+// node whose moves have all been tried. Policies are template
+// parameters of compute_tree and compute_move, so the selection is
+// inlined into the search loop. uses_priors and uses_variance tell the
+// search which PolicyStatistics to keep for the nodes. score_merged
+// scores a root child from the statistics of all threads when they
+// are shared (ComputeOptions::sync_interval).
+
+// UCT [1]: wins / n + c sqrt(log(N) / n). Blended with RAVE if
+// ComputeOptions::use_rave is set.
+struct UCB1
+{
+	static const bool uses_priors = false;
+	static const bool uses_variance = false;
+
+	template<typename State>
+	static Node<State>* select_child(const Node<State>& node, const ComputeOptions& options)
+	{
+		if (options.use_rave) {
+			return node.select_child_RAVE(options.rave_equivalence, options.exploration_constant, options.prefetch);
+		}
+		return node.select_child_UCT(options.exploration_constant);
+	}
+
+	// Score of a child from statistics summed over several trees, for
+	// a parent with parent_visits visits in total.
+	static double score_merged(const MoveStatistics& child, double, double parent_visits,
+	                           const ComputeOptions& options)
+	{
+		double exploration = options.exploration_constant * options.exploration_constant * std::log(parent_visits);
+		double value = double(child.wins) / double(child.visits);
+		if (options.use_rave) {
+			value = rave_value(child.wins, double(child.visits), child.rave_wins, double(child.rave_visits),
+			                   rave_beta(options.rave_equivalence, parent_visits));
+		}
+		return value + std::sqrt(exploration / double(child.visits));
+	}
+};
+
+// UCB1-Tuned [3]: wins / n + c / sqrt(2) sqrt(log(N) / n min(1/4, V)),
+// where V is the sample variance of the results plus sqrt(2 log(N) / n).
+struct UCB1Tuned
+{
+	static const bool uses_priors = false;
+	static const bool uses_variance = true;
+
+	template<typename State>
+	static Node<State>* select_child(const Node<State>& node, const ComputeOptions& options)
+	{
+		attest( ! node.children.empty());
+		double log_visits = std::log(double(node.visits));
+		double scale = options.exploration_constant / std::sqrt(2.0);
+		Node<State>* best_child = nullptr;
+		double best_score = 0;
+		for (size_t c = 0; c < node.children.size(); ++c) {
+			if (options.prefetch && c + prefetch_distance < node.children.size()) {
+				prefetch(node.children[c + prefetch_distance]);
+			}
+			auto child = node.children[c];
+			double score = score_child(child->wins, child->visits, child->wins_squared(), log_visits, scale);
+			if (best_child == nullptr || score > best_score) {
+				best_child = child;
+				best_score = score;
+			}
+		}
+		return best_child;
+	}
+
+	static double score_merged(const MoveStatistics& child, double, double parent_visits,
+	                           const ComputeOptions& options)
+	{
+		return score_child(child.wins, double(child.visits), child.wins_squared, std::log(parent_visits),
+		                   options.exploration_constant / std::sqrt(2.0));
+	}
+
+private:
+	static double score_child(double wins, double n, double wins_squared, double log_visits, double scale)
+	{
+		double mean = wins / n;
+		double variance = wins_squared / n - mean * mean + std::sqrt(2.0 * log_visits / n);
+		return mean + scale * std::sqrt(log_visits / n * std::min(0.25, variance));
+	}
+};
+
+// PUCT [4]: wins / n + c P sqrt(N) / (1 + n), where P is the prior
+// probability of the move. States can provide the priors with
+// get_prior(move); otherwise they are uniform.
+struct PUCT
+{
+	static const bool uses_priors = true;
+	static const bool uses_variance = false;
+
+	template<typename State>
+	static Node<State>* select_child(const Node<State>& node, const ComputeOptions& options)
+	{
+		attest( ! node.children.empty());
+		double exploration = options.exploration_constant * std::sqrt(double(node.visits));
+		Node<State>* best_child = nullptr;
+		double best_score = 0;
+		for (size_t c = 0; c < node.children.size(); ++c) {
+			if (options.prefetch && c + prefetch_distance < node.children.size()) {
+				prefetch(node.children[c + prefetch_distance]);
+			}
+			double wins = node.child_statistics[2 * c];
+			double visits = node.child_statistics[2 * c + 1];
+			double score = score_child(wins, visits, node.children[c]->prior(), exploration);
+			if (best_child == nullptr || score > best_score) {
+				best_child = node.children[c];
+				best_score = score;
+			}
+		}
+		return best_child;
+	}
+
+	static double score_merged(const MoveStatistics& child, double prior, double parent_visits,
+	                           const ComputeOptions& options)
+	{
+		return score_child(child.wins, double(child.visits), prior,
+		                   options.exploration_constant * std::sqrt(parent_visits));
+	}
+
+private:
+	static double score_child(double wins, double visits, double prior, double exploration)
+	{
+		return wins / visits + exploration * prior / (1.0 + visits);
+	}
+};
+
+// Whether State has a get_prior member for the priors of PUCT.
+template<typename State>
+struct HasGetPrior
+{
+	template<typename S>
+	static auto test(int) -> decltype(double(std::declval<const S&>().get_prior(std::declval<typename S::Move>())),
+	                                  std::true_type());
+	template<typename S>
+	static std::false_type test(...);
+	static const bool value = decltype(test<State>(0))::value;
+};
+
+// Prior probability of move in state. Uses State::get_prior if it
+// exists and is uniform over the number_of_moves otherwise.
+template<typename State>
+typename std::enable_if<HasGetPrior<State>::value, double>::type
+get_move_prior(const State& state, const typename State::Move& move, std::size_t)
+{
+	return state.get_prior(move);
+}
+
+template<typename State>
+typename std::enable_if< ! HasGetPrior<State>::value, double>::type
+get_move_prior(const State&, const typename State::Move&, std::size_t number_of_moves)
+{
+	return 1.0 / double(number_of_moves);
+}
+
+// Maps moves to a dense range of indices. The default is not dense;
+// specialize it for states whose moves are small integers:
+//
+//   template<> struct MoveIndex<GameState>
+//   {
+//       static const bool is_dense = true;
+//       // Number of indices needed for all moves from state.
+//       static std::size_t size(const GameState& state);
+//       static std::size_t index(const GameState::Move& move);
+//   };
+//
+template<typename State>
+struct MoveIndex
+{
+	static const bool is_dense = false;
+};
+
+// Maps the moves available in the root state to their positions
+// in the vector returned by get_moves().
+template<typename State>
+class RootMoveIndex
+{
+public:
+	typedef typename State::Move Move;
+
+	RootMoveIndex(const State& root_state, const vector<Move>& moves_)
+		: moves(moves_)
+	{
+		initialize(root_state, std::integral_constant<bool, MoveIndex<State>::is_dense>());
+	}
+
+	std::size_t size() const
+	{
+		return moves.size();
+	}
+
+	const Move& move(std::size_t position) const
+	{
+		return moves[position];
+	}
+
+	std::size_t operator()(const Move& move) const
+	{
+		return position(move, std::integral_constant<bool, MoveIndex<State>::is_dense>());
+	}
+
+private:
+	void initialize(const State& root_state, std::true_type)
+	{
+		dense_positions.resize(MoveIndex<State>::size(root_state), moves.size());
+		for (size_t i = 0; i < moves.size(); ++i) {
+			auto index = MoveIndex<State>::index(moves[i]);
+			attest(index < dense_positions.size());
+			dense_positions[index] = i;
+		}
+	}
+
+	void initialize(const State&, std::false_type)
+	{
+		for (size_t i = 0; i < moves.size(); ++i) {
+			positions[moves[i]] = i;
+		}
+	}
+
+	std::size_t position(const Move& move, std::true_type) const
+	{
+		auto index = MoveIndex<State>::index(move);
+		dattest(index < dense_positions.size() && dense_positions[index] < moves.size());
+		return dense_positions[index];
+	}
+
+	std::size_t position(const Move& move, std::false_type) const
+	{
+		auto itr = positions.find(move);
+		attest(itr != positions.end());
+		return itr->second;
+	}
+
+	vector<Move> moves;
+	vector<std::size_t> dense_positions;
+	std::map<Move, std::size_t> positions;
+};
+
+// Adds the statistics of the children of root to statistics,
+// which is indexed by position in the root moves.
+template<typename State>
+void collect_root_statistics(const Node<State>& root,
+                             const RootMoveIndex<State>& move_index,
+                             vector<MoveStatistics>* statistics)
+{
+	statistics->resize(move_index.size());
+	for (auto child: root.children) {
+		auto& move_statistics = (*statistics)[move_index(child->move)];
+		move_statistics.visits       += child->visits;
+		move_statistics.wins         += child->wins;
+		move_statistics.wins_squared += child->wins_squared();
+		move_statistics.rave_wins    += child->rave_wins();
+		move_statistics.rave_visits  += child->rave_visits();
+	}
+}
+
+// Returns the position of the root move with the highest expected
+// success rate, assuming a uniform prior (Beta(1, 1)).
+// https://en.wikipedia.org/wiki/Beta_distribution
+inline std::size_t best_root_position(const vector<MoveStatistics>& statistics)
+{
+	double best_score = -1;
+	size_t best_position = 0;
+	for (size_t i = 0; i < statistics.size(); ++i) {
+		double v = statistics[i].visits;
+		double w = statistics[i].wins;
+		if (v == 0) {
+			continue;
+		}
+		double expected_success_rate = (w + 1) / (v + 2);
+		if (expected_success_rate > best_score) {
+			best_position = i;
+			best_score = expected_success_rate;
+		}
+	}
+	return best_position;
+}
+
+// Returns the position of the root move with the most visits.
+inline std::size_t most_visited_root_position(const vector<MoveStatistics>& statistics)
+{
+	size_t best_position = 0;
+	for (size_t i = 1; i < statistics.size(); ++i) {
+		if (statistics[i].visits > statistics[best_position].visits) {
+			best_position = i;
+		}
+	}
+	return best_position;
+}
+
+// Prints the statistics of all root moves and of the best move.
+template<typename State>
+void print_root_statistics(std::ostream& out,
+                           const RootMoveIndex<State>& move_index,
+                           const vector<MoveStatistics>& statistics,
+                           long long games_played,
+                           std::size_t best_position)
+{
+	for (size_t i = 0; i < move_index.size(); ++i) {
+		double v = statistics[i].visits;
+		double w = statistics[i].wins;
+		if (v == 0) {
+			continue;
+		}
+		out << "Move: " << move_index.move(i)
+		    << " (" << std::setw(2) << std::right << int(100.0 * v / double(games_played) + 0.5) << "% visits)"
+		    << " (" << std::setw(2) << std::right << int(100.0 * w / v + 0.5)    << "% wins)" << std::endl;
+	}
+
+	auto best_wins = statistics[best_position].wins;
+	auto best_visits = statistics[best_position].visits;
+	out << "----" << std::endl;
+	out << "Best: " << move_index.move(best_position)
+	    << " (" << 100.0 * best_visits / double(games_played) << "% visits)"
+	    << " (" << 100.0 * best_wins / best_visits << "% wins)" << std::endl;
+}
+
+// Returns the principal variation of the search in the trees of
+// roots, starting with first_move. After the first move, the most
+// visited move is followed, with the visits summed over the trees
+// that contain the position. At most max_length moves are returned.
+template<typename State>
+vector<typename State::Move> principal_variation(const vector<const Node<State>*>& roots,
+                                                 const typename State::Move& first_move,
+                                                 std::size_t max_length = 1000)
+{
+	typedef typename State::Move Move;
+	vector<Move> variation;
+	vector<const Node<State>*> nodes = roots;
+	Move move = first_move;
+	while (variation.size() < max_length) {
+		variation.push_back(move);
+
+		// Descend in all trees that contain the move.
+		vector<const Node<State>*> next_nodes;
+		for (auto node: nodes) {
+			for (auto child: node->children) {
+				if (child->move == move) {
+					next_nodes.push_back(child);
+					break;
+				}
+			}
+		}
+		nodes.swap(next_nodes);
+
+		// Sum the visits of the children of the position.
+		vector<Move> child_moves;
+		vector<long long> child_visits;
+		for (auto node: nodes) {
+			for (auto child: node->children) {
+				auto itr = std::find(child_moves.begin(), child_moves.end(), child->move);
+				if (itr == child_moves.end()) {
+					child_moves.push_back(child->move);
+					child_visits.push_back(child->visits);
+				}
+				else {
+					child_visits[itr - child_moves.begin()] += child->visits;
+				}
+			}
+		}
+		if (child_moves.empty()) {
+			break;
+		}
+		auto most_visited = std::max_element(child_visits.begin(), child_visits.end()) - child_visits.begin();
+		move = child_moves[most_visited];
+	}
+	return variation;
+}
+
+// Returns the principal variation in the tree of root, starting with
+// the most visited move. Empty if root has no children.
+template<typename State>
+vector<typename State::Move> principal_variation(const Node<State>& root, std::size_t max_length = 1000)
+{
+	if ( ! root.has_children() || max_length == 0) {
+		return vector<typename State::Move>();
+	}
+	auto most_visited = *std::max_element(root.children.begin(), root.children.end(),
+		[](const Node<State>* a, const Node<State>* b) { return a->visits < b->visits; });
+	vector<const Node<State>*> roots(1, &root);
+	return principal_variation(roots, most_visited->move, max_length);
+}
+
+// Root statistics shared between the threads of a search. Each
+// thread periodically publishes the statistics of its own root and,
+// if sync_interval is set, receives the sum of what the other threads
+// have published.
+template<typename State>
+class SharedRootStatistics
+{
+public:
+	// How often the threads publish their statistics when they are
+	// only read by the caller (sync_interval not set).
+	static const int default_publish_interval = 100;
+
+	SharedRootStatistics(const RootMoveIndex<State>& move_index_)
+		: move_index(move_index_),
+		  stop(false)
+	{ }
+
+	// Returns the slot to use for a new thread.
+	int add_thread()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		published.push_back(vector<MoveStatistics>(move_index.size()));
+		published_visits.push_back(0);
+		published_iterations.push_back(0);
+		return int(published.size()) - 1;
+	}
+
+	// Publishes the root statistics of a thread after the given number
+	// of iterations.
+	void publish(int slot, const Node<State>& root, long long iterations)
+	{
+		vector<MoveStatistics> own;
+		collect_root_statistics(root, move_index, &own);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		store(slot, own, root.visits, iterations);
+	}
+
+	// Publishes the root statistics of a thread as above. The combined
+	// statistics of all other threads are stored in others and their
+	// total number of visits in others_visits.
+	void exchange(int slot,
+	              const Node<State>& root,
+	              long long iterations,
+	              vector<MoveStatistics>* others,
+	              long long* others_visits)
+	{
+		vector<MoveStatistics> own;
+		collect_root_statistics(root, move_index, &own);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		store(slot, own, root.visits, iterations);
+
+		others->assign(move_index.size(), MoveStatistics());
+		*others_visits = 0;
+		for (size_t t = 0; t < published.size(); ++t) {
+			if (t == size_t(slot)) {
+				continue;
+			}
+			*others_visits += published_visits[t];
+			for (size_t i = 0; i < move_index.size(); ++i) {
+				add_move_statistics(&(*others)[i], published[t][i]);
+			}
+		}
+	}
+
+	// Stores the combined statistics of all threads in statistics and
+	// returns the total number of iterations.
+	long long get_statistics(vector<MoveStatistics>* statistics) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		statistics->assign(move_index.size(), MoveStatistics());
+		long long iterations = 0;
+		for (size_t t = 0; t < published.size(); ++t) {
+			iterations += published_iterations[t];
+			for (size_t i = 0; i < move_index.size(); ++i) {
+				add_move_statistics(&(*statistics)[i], published[t][i]);
+			}
+		}
+		return iterations;
+	}
+
+	const RootMoveIndex<State>& get_move_index() const
+	{
+		return move_index;
+	}
+
+	// Asks all threads to stop after their current iteration.
+	void request_stop()
+	{
+		stop = true;
+	}
+
+	bool stop_requested() const
+	{
+		return stop.load(std::memory_order_relaxed);
+	}
+
+private:
+	void store(int slot, vector<MoveStatistics>& own, long long visits, long long iterations)
+	{
+		published[slot].swap(own);
+		published_visits[slot] = visits;
+		published_iterations[slot] = iterations;
+	}
+
+	mutable std::mutex mutex;
+	const RootMoveIndex<State>& move_index;
+	vector<vector<MoveStatistics>> published;
+	vector<long long> published_visits;
+	vector<long long> published_iterations;
+	std::atomic<bool> stop;
+};
+
+// Selects a child of the root with Policy, using the sum of the
+// statistics of the root and the statistics of the other threads.
+// child_positions contains the root move position of each child.
+template<typename Policy, typename State>
+Node<State>* select_root_child_shared(const Node<State>& root,
+                                      const vector<std::size_t>& child_positions,
+                                      const vector<MoveStatistics>& others,
+                                      long long others_visits,
+                                      const ComputeOptions& options)
+{
+	attest( ! root.children.empty());
+	double parent_visits = double(root.visits + others_visits);
+	Node<State>* best_child = nullptr;
+	double best_score = 0;
+	for (size_t c = 0; c < root.children.size(); ++c) {
+		auto child = root.children[c];
+		MoveStatistics merged = others[child_positions[c]];
+		merged.visits       += child->visits;
+		merged.wins         += child->wins;
+		merged.wins_squared += child->wins_squared();
+		merged.rave_wins    += child->rave_wins();
+		merged.rave_visits  += child->rave_visits();
+		double score = Policy::score_merged(merged, child->prior(), parent_visits, options);
+		if (best_child == nullptr || score > best_score) {
+			best_child = child;
+			best_score = score;
+		}
+	}
+	return best_child;
+}
+
+// Performs a random move and returns it. States whose do_random_move
+// returns the move are used directly; otherwise a move is drawn
+// uniformly from get_moves().
+template<typename State, typename RandomEngine>
+typename std::enable_if<
+	std::is_same<decltype(std::declval<State&>().do_random_move(static_cast<RandomEngine*>(nullptr))),
+	             typename State::Move>::value,
+	typename State::Move>::type
+do_recorded_random_move(State* state, RandomEngine* engine)
+{
+	return state->do_random_move(engine);
+}
+
+template<typename State, typename RandomEngine>
+typename std::enable_if<
+	! std::is_same<decltype(std::declval<State&>().do_random_move(static_cast<RandomEngine*>(nullptr))),
+	               typename State::Move>::value,
+	typename State::Move>::type
+do_recorded_random_move(State* state, RandomEngine* engine)
+{
+	auto moves = state->get_moves();
+	attest( ! moves.empty());
+	std::uniform_int_distribution<std::size_t> moves_distribution(0, moves.size() - 1);
+	auto move = moves[moves_distribution(*engine)];
+	state->do_move(move);
+	return move;
+}
+
+// Evaluates leaves of the search tree instead of random playouts.
+// The search collects ComputeOptions::leaf_batch_size leaves before
+// calling evaluate, so that evaluators which are faster in batches
+// (e.g. learned models) can be used. compute_move calls evaluate from
+// all its threads, so implementations need to be thread-safe.
+template<typename State>
+class LeafEvaluator
+{
+public:
+	virtual ~LeafEvaluator() { }
+
+	// Stores in values[i] the value of states[i] in [0, 1] for the
+	// player who made the last move, i.e. an estimate of
+	// states[i].get_result(states[i].player_to_move).
+	virtual void evaluate(const State* states, std::size_t count, double* values) = 0;
+};
+
+// Evaluates each leaf with one random playout. Mostly useful for
+// testing and benchmarking the batching. Threads evaluate their
+// batches concurrently; each call has its own random engine.
+template<typename State>
+class PlayoutEvaluator :
+	public LeafEvaluator<State>
+{
+public:
+	PlayoutEvaluator(std::mt19937_64::result_type seed_ = 1)
+		: seed(seed_),
+		  calls(0)
+	{ }
+
+	virtual void evaluate(const State* states, std::size_t count, double* values)
+	{
+		std::mt19937_64 random_engine(seed + calls.fetch_add(1, std::memory_order_relaxed));
+		for (std::size_t i = 0; i < count; ++i) {
+			State state = states[i];
+			while (state.has_moves()) {
+				state.do_random_move(&random_engine);
+			}
+			values[i] = state.get_result(states[i].player_to_move);
+		}
+	}
+
+private:
+	const std::mt19937_64::result_type seed;
+	std::atomic<std::mt19937_64::result_type> calls;
+};
+
+// Leaves waiting for a LeafEvaluator. The visits of the leaves and
+// their ancestors are counted when they are added (virtual loss), so
+// that the following iterations are steered away from them. The
+// results are added when the batch is evaluated.
+template<typename State>
+class LeafBatch
+{
+public:
+	std::size_t size() const
+	{
+		return nodes.size();
+	}
+
+	void add(Node<State>* leaf, const State& state)
+	{
+		for (auto node = leaf; node != nullptr; node = node->parent) {
+			node->update(0.0, 1, 0.0);
+		}
+		nodes.push_back(leaf);
+		states.push_back(state);
+	}
+
+	void evaluate(LeafEvaluator<State>* evaluator)
+	{
+		if (nodes.empty()) {
+			return;
+		}
+		values.resize(nodes.size());
+		evaluator->evaluate(states.data(), states.size(), values.data());
+		for (std::size_t i = 0; i < nodes.size(); ++i) {
+			attest(0.0 <= values[i] && values[i] <= 1.0);
+			const int player = states[i].player_to_move;
+			for (auto node = nodes[i]; node != nullptr; node = node->parent) {
+				double result = node->player_to_move == player ? values[i] : 1.0 - values[i];
+				node->update(result, 0, result * result);
+			}
+		}
+		nodes.clear();
+		states.clear();
+	}
+
+private:
+	vector<Node<State>*> nodes;
+	vector<State> states;
+	vector<double> values;
+};
+
+// FNV-1a hashing of 64-bit values, for implementing State::hash.
+static const std::uint64_t hash_seed = 14695981039346656037ULL;
+
+inline std::uint64_t hash_combine(std::uint64_t hash, std::uint64_t value)
+{
+	for (int i = 0; i < 8; ++i) {
+		hash ^= (value >> (8 * i)) & 0xff;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Whether the opening book can be used with State, which requires
+// State::hash and integral moves.
+template<typename State>
+struct SupportsOpeningBook
+{
+	template<typename S>
+	static auto test(int) -> decltype(std::declval<const S&>().hash(), std::true_type());
+	template<typename S>
+	static std::false_type test(...);
+	static const bool value = decltype(test<State>(0))::value &&
+	                          std::is_integral<typename State::Move>::value;
+};
+
+// The statistics of a move in the state with the given hash.
+struct BookEntry
+{
+	std::uint64_t hash;
+	std::int64_t move;
+	std::int64_t visits;
+	double wins;
+	// Sum of the squared results, for policies that use the variance.
+	double wins_squared;
+};
+
+// The book file is this header followed by the entries, sorted by
+// hash and move. Integers are stored in the byte order of the
+// machine that wrote the file.
+struct BookHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t entry_size;
+	std::uint64_t number_of_entries;
+};
+
+static const char book_magic[8] = {'M', 'C', 'T', 'S', 'B', 'O', 'O', 'K'};
+static const std::uint32_t book_version = 2;
+
+// An opening book written by OpeningBookBuilder. The file is
+// memory-mapped and the entries are used in place where mmap is
+// available; otherwise the entries are read into memory.
+class OpeningBook
+{
+public:
+	explicit OpeningBook(const std::string& file_name)
+		: entries(nullptr),
+		  number_of_entries(0),
+		  mapping(nullptr),
+		  mapping_size(0)
+	{
+		BookHeader header;
+		std::ifstream fin(file_name, std::ios::binary);
+		if ( ! fin.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+			throw std::runtime_error("Could not read opening book " + file_name + ".");
+		}
+		if (std::memcmp(header.magic, book_magic, sizeof(book_magic)) != 0 ||
+		    header.version != book_version ||
+		    header.entry_size != sizeof(BookEntry)) {
+			throw std::runtime_error(file_name + " is not a valid opening book.");
+		}
+		number_of_entries = std::size_t(header.number_of_entries);
+		std::size_t file_size = sizeof(BookHeader) + number_of_entries * sizeof(BookEntry);
+
+		#ifdef MCTS_HAS_MMAP
+		int file = ::open(file_name.c_str(), O_RDONLY);
+		if (file >= 0) {
+			struct stat file_stat;
+			if (::fstat(file, &file_stat) == 0 && std::size_t(file_stat.st_size) >= file_size) {
+				void* address = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+				if (address != MAP_FAILED) {
+					mapping = address;
+					mapping_size = file_size;
+					entries = reinterpret_cast<const BookEntry*>(
+						static_cast<const char*>(address) + sizeof(BookHeader));
+				}
+			}
+			::close(file);
+		}
+		#endif
+
+		if (mapping == nullptr) {
+			buffer.resize(number_of_entries);
+			if (number_of_entries > 0 &&
+			    ! fin.read(reinterpret_cast<char*>(buffer.data()), number_of_entries * sizeof(BookEntry))) {
+				throw std::runtime_error("Could not read opening book " + file_name + ".");
+			}
+			entries = buffer.data();
+		}
+	}
+
+	~OpeningBook()
+	{
+		#ifdef MCTS_HAS_MMAP
+		if (mapping != nullptr) {
+			::munmap(mapping, mapping_size);
+		}
+		#endif
+	}
+
+	std::size_t size() const
+	{
+		return number_of_entries;
+	}
+
+	// Returns the range of entries for the state with the given hash.
+	std::pair<const BookEntry*, const BookEntry*> find(std::uint64_t hash) const
+	{
+		auto end = entries + number_of_entries;
+		auto first = std::lower_bound(entries, end, hash,
+			[](const BookEntry& entry, std::uint64_t value) { return entry.hash < value; });
+		auto last = first;
+		while (last != end && last->hash == hash) {
+			++last;
+		}
+		return std::make_pair(first, last);
+	}
+
+private:
+	OpeningBook(const OpeningBook&);
+	OpeningBook& operator = (const OpeningBook&);
+
+	const BookEntry* entries;
+	std::size_t number_of_entries;
+	void* mapping;
+	std::size_t mapping_size;
+	vector<BookEntry> buffer;
+};
+
+// Collects the statistics of search trees and writes an opening book.
+class OpeningBookBuilder
+{
+public:
+	// Adds the statistics of the moves in the first plies of the tree
+	// of root. Moves with fewer than minimum_visits visits are skipped.
+	template<typename State>
+	void add_tree(const Node<State>& root, const State& root_state, int plies, long long minimum_visits = 1)
+	{
+		static_assert(SupportsOpeningBook<State>::value,
+		              "The opening book requires State::hash and integral moves.");
+		if (plies <= 0) {
+			return;
+		}
+		auto hash = root_state.hash();
+		for (auto child: root.children) {
+			if (child->visits < minimum_visits) {
+				continue;
+			}
+			// Only nodes that had PolicyStatistics from the start (see
+			// UCB1Tuned and PUCT) have summed all their squared results.
+			// Otherwise wins is used, which is an upper bound for
+			// results in [0, 1] and overestimates the variance.
+			bool has_squared_results = child->has_policy_statistics() && child->rave_visits() == 0;
+			add(hash, std::int64_t(child->move), child->visits, child->wins,
+			    has_squared_results ? child->wins_squared() : child->wins);
+			State state = root_state;
+			state.do_move(child->move);
+			add_tree(*child, state, plies - 1, minimum_visits);
+		}
+	}
+
+	void add(std::uint64_t hash, std::int64_t move, long long visits, double wins, double wins_squared)
+	{
+		auto& statistics = entries[std::make_pair(hash, move)];
+		statistics.visits += visits;
+		statistics.wins += wins;
+		statistics.wins_squared += wins_squared;
+	}
+
+	std::size_t size() const
+	{
+		return entries.size();
+	}
+
+	void write(const std::string& file_name) const
+	{
+		BookHeader header;
+		std::memcpy(header.magic, book_magic, sizeof(book_magic));
+		header.version = book_version;
+		header.entry_size = sizeof(BookEntry);
+		header.number_of_entries = entries.size();
+
+		std::ofstream fout(file_name, std::ios::binary);
+		fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (auto& item: entries) {
+			BookEntry entry;
+			entry.hash = item.first.first;
+			entry.move = item.first.second;
+			entry.visits = item.second.visits;
+			entry.wins = item.second.wins;
+			entry.wins_squared = item.second.wins_squared;
+			fout.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		}
+		if ( ! fout) {
+			throw std::runtime_error("Could not write opening book " + file_name + ".");
+		}
+	}
+
+private:
+	std::map<std::pair<std::uint64_t, std::int64_t>, MoveStatistics> entries;
+};
+
+// Finds the best legal move of the book for state. Returns false if
+// the book has fewer than minimum_visits visits for state.
+template<typename State>
+bool get_book_move(const OpeningBook& book,
+                   const State& state,
+                   long long minimum_visits,
+                   typename State::Move* move,
+                   std::true_type)
+{
+	auto moves = state.get_moves();
+	vector<MoveStatistics> statistics(moves.size());
+	long long visits = 0;
+	auto range = book.find(state.hash());
+	for (auto entry = range.first; entry != range.second; ++entry) {
+		auto itr = std::find(moves.begin(), moves.end(), typename State::Move(entry->move));
+		if (itr != moves.end()) {
+			auto& move_statistics = statistics[itr - moves.begin()];
+			move_statistics.visits += entry->visits;
+			move_statistics.wins += entry->wins;
+			visits += entry->visits;
+		}
+	}
+	if (visits == 0 || visits < minimum_visits) {
+		return false;
+	}
+	*move = moves[best_root_position(statistics)];
+	return true;
+}
+
+template<typename State>
+bool get_book_move(const OpeningBook&, const State&, long long, typename State::Move*, std::false_type)
+{
+	throw std::runtime_error("The opening book requires State::hash and integral moves.");
+}
+
+template<typename State>
+bool get_book_move(const OpeningBook& book, const State& state, long long minimum_visits, typename State::Move* move)
+{
+	return get_book_move(book, state, minimum_visits, move,
+	                     std::integral_constant<bool, SupportsOpeningBook<State>::value>());
+}
+
+// Adds the children of root that are in the book, with the statistics
+// of the book. Returns the number of children added.
+//
+// Only one thread of a search should seed its root (see
+// options_for_thread), so that the book is counted once when the
+// statistics of the threads are combined.
+template<typename State, typename Policy>
+int seed_root_from_book(Node<State>* root, const State& root_state, const OpeningBook& book, std::true_type)
+{
+	int number_of_children = 0;
+	auto range = book.find(root_state.hash());
+	for (auto entry = range.first; entry != range.second; ++entry) {
+		auto move = typename State::Move(entry->move);
+		// Skips illegal moves (hash collisions) and duplicates.
+		if (std::find(root->moves.begin(), root->moves.end(), move) == root->moves.end()) {
+			continue;
+		}
+		auto number_of_moves = root->moves.size() + root->children.size();
+		State state = root_state;
+		state.do_move(move);
+		auto child = root->add_child(move, state);
+		if (Policy::uses_variance) {
+			child->add_policy_statistics();
+		}
+		if (Policy::uses_priors) {
+			child->set_prior(get_move_prior(root_state, move, number_of_moves));
+		}
+		// The visits are clamped so that the visits of the root (an
+		// int) cannot overflow, even with hundreds of book moves.
+		const std::int64_t max_visits = std::numeric_limits<int>::max() / 1024;
+		std::int64_t visits = std::min(entry->visits, max_visits);
+		double scale = double(visits) / double(entry->visits);
+		child->update(entry->wins * scale, int(visits), entry->wins_squared * scale);
+		root->visits += int(visits);
+		number_of_children++;
+	}
+	return number_of_children;
+}
+
+template<typename State, typename Policy>
+int seed_root_from_book(Node<State>*, const State&, const OpeningBook&, std::false_type)
+{
+	throw std::runtime_error("The opening book requires State::hash and integral moves.");
+}
+
+// Returns the options for search thread t of a search with options.
+// Only the first thread seeds its root from the opening book.
+inline ComputeOptions options_for_thread(const ComputeOptions& options, int t)
+{
+	ComputeOptions thread_options = options;
+	if (t > 0) {
+		thread_options.opening_book = nullptr;
+	}
+	return thread_options;
+}
+
+// Starts search thread t of a search with options. The new thread
+// pins itself to its core in options.thread_cores and calls
+// func(thread_options, seed), where thread_options are given by
+// options_for_thread and seed is the seed of thread t plus
+// seed_offset. Threads that fail to pin themselves are counted in
+// unpinned_threads.
+template<typename Function>
+auto start_search_thread(const ComputeOptions& options,
+                         int t,
+                         std::atomic<int>* unpinned_threads,
+                         Function func,
+                         std::mt19937_64::result_type seed_offset = 0)
+	-> std::future<decltype(func(options, seed_offset))>
+{
+	typedef decltype(func(options, seed_offset)) Result;
+	auto thread_options = options_for_thread(options, t);
+	std::mt19937_64::result_type seed = 1012411 * t + 12515 + seed_offset;
+	return std::async(std::launch::async, [t, thread_options, seed, unpinned_threads, func] () -> Result
+	{
+		if ( ! thread_options.thread_cores.empty() && ! pin_search_thread(thread_options, t)) {
+			unpinned_threads->fetch_add(1);
+		}
+		return func(thread_options, seed);
+	});
+}
+
+// Whether State has an evaluate member for unfinished games.
+template<typename State>
+struct HasEvaluate
+{
+	template<typename S>
+	static auto test(int) -> decltype(std::declval<const S&>().evaluate(1), std::true_type());
+	template<typename S>
+	static std::false_type test(...);
+	static const bool value = decltype(test<State>(0))::value;
+};
+
+// Result of a playout for the player who made the last move into a
+// state where current_player_to_move is to move. Unfinished playouts
+// are scored with State::evaluate.
+template<typename State>
+typename std::enable_if<HasEvaluate<State>::value, double>::type
+playout_result(const State& state, int current_player_to_move, bool finished)
+{
+	return finished ? state.get_result(current_player_to_move) : state.evaluate(current_player_to_move);
+}
+
+template<typename State>
+typename std::enable_if< ! HasEvaluate<State>::value, double>::type
+playout_result(const State& state, int current_player_to_move, bool finished)
+{
+	attest(finished);
+	return state.get_result(current_player_to_move);
+}
+
+// A move played during one iteration, together with the player
+// who made it. Used for the RAVE statistics.
+template<typename Move>
+struct PlayedMove
+{
+	PlayedMove(const Move& move_, int player_) : move(move_), player(player_) { }
+	Move move;
+	int player;
+};
+
+// Updates the RAVE statistics of the children of node. played contains
+// all moves of the iteration and depth is the index in played of the
+// first move made after node. Children without PolicyStatistics are
+// only updated if allocate is set. Returns the number of bytes
+// allocated.
+template<typename State>
+std::size_t update_rave(Node<State>* node,
+                        const vector<PlayedMove<typename State::Move>>& played,
+                        std::size_t depth,
+                        const double results[3],
+                        bool allocate)
+{
+	std::size_t allocated = 0;
+	for (auto child: node->children) {
+		if ( ! allocate && ! child->has_policy_statistics()) {
+			continue;
+		}
+		for (auto i = depth; i < played.size(); ++i) {
+			if (played[i].player == node->player_to_move && played[i].move == child->move) {
+				if ( ! child->has_policy_statistics()) {
+					allocated += sizeof(PolicyStatistics);
+				}
+				child->update_rave(results[child->player_to_move]);
+				break;
+			}
+		}
+	}
+	return allocated;
+}
+
+// Hardware performance counters of the calling thread, read with
+// perf_event_open. Only user-space events are counted. The counters
+// are opened as one group, so that they are read with a single system
+// call, and are scaled if the kernel had to multiplex them. Counters
+// that the system does not provide (e.g. in virtual machines or with
+// a restrictive perf_event_paranoid) are not available.
+class PerfCounters
+{
+public:
+	enum Counter {CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, DTLB_MISSES, NUMBER_OF_COUNTERS};
+
+	// With inherit, threads created by the calling thread after the
+	// counters are opened are also counted.
+	explicit PerfCounters(bool inherit = false)
+		: group_fd(-1),
+		  group_size(0)
+	{
+		for (int c = 0; c < NUMBER_OF_COUNTERS; ++c) {
+			fds[c] = -1;
+			group_position[c] = -1;
+			#ifdef MCTS_HAS_PERF_EVENTS
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			switch (c) {
+				case CYCLES:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+				case INSTRUCTIONS:  attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+				case CACHE_MISSES:  attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+				case BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+				case DTLB_MISSES:
+					attr.type = PERF_TYPE_HW_CACHE;
+					attr.config = PERF_COUNT_HW_CACHE_DTLB
+					              | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+					              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+					break;
+			}
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.inherit = inherit ? 1 : 0;
+			attr.read_format = PERF_FORMAT_GROUP
+			                   | PERF_FORMAT_TOTAL_TIME_ENABLED
+			                   | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			// The first counter that can be opened leads the group.
+			fds[c] = int(::syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+			if (fds[c] >= 0) {
+				if (group_fd < 0) {
+					group_fd = fds[c];
+				}
+				group_position[c] = group_size++;
+			}
+			#else
+			(void)inherit;
+			#endif
+		}
+	}
+
+	~PerfCounters()
+	{
+		#ifdef MCTS_HAS_PERF_EVENTS
+		for (int c = 0; c < NUMBER_OF_COUNTERS; ++c) {
+			if (fds[c] >= 0) {
+				::close(fds[c]);
+			}
+		}
+		#endif
+	}
+
+	bool available(int counter) const
+	{
+		return fds[counter] >= 0;
+	}
+
+	// Reads the current values. Counters that are not available
+	// read as zero.
+	void read(unsigned long long values[NUMBER_OF_COUNTERS]) const
+	{
+		for (int c = 0; c < NUMBER_OF_COUNTERS; ++c) {
+			values[c] = 0;
+		}
+		#ifdef MCTS_HAS_PERF_EVENTS
+		if (group_fd < 0) {
+			return;
+		}
+		// Number of counters, time enabled, time running and the
+		// values in the order the counters were added to the group.
+		unsigned long long data[3 + NUMBER_OF_COUNTERS];
+		auto size = (3 + group_size) * sizeof(data[0]);
+		if (::read(group_fd, data, size) != ssize_t(size) || data[0] != (unsigned long long)(group_size)) {
+			return;
+		}
+		double scale = 1.0;
+		if (data[2] > 0 && data[2] < data[1]) {
+			scale = double(data[1]) / double(data[2]);
+		}
+		for (int c = 0; c < NUMBER_OF_COUNTERS; ++c) {
+			if (group_position[c] >= 0) {
+				values[c] = (unsigned long long)(scale * data[3 + group_position[c]]);
+			}
+		}
+		#endif
+	}
+
+	static const char* counter_name(int counter)
+	{
+		static const char* names[NUMBER_OF_COUNTERS] =
+			{"cycles", "instructions", "cache_misses", "branch_misses", "dtlb_misses"};
+		return names[counter];
+	}
+
+private:
+	PerfCounters(const PerfCounters&);
+	PerfCounters& operator = (const PerfCounters&);
+
+	int fds[NUMBER_OF_COUNTERS];
+	int group_position[NUMBER_OF_COUNTERS];
+	int group_fd;
+	int group_size;
+};
+
+// Counters and timers for the phases of the search. The number of
+// threads, iterations, nodes and the memory are always collected. The
+// timers and the depth histogram are only collected when
+// MCTS_INSTRUMENTATION is defined; otherwise they are zero. The
+// hardware counters also require MCTS_PERF_COUNTERS.
+struct SearchStatistics
+{
+	enum Phase {SELECT, EXPAND, ROLLOUT, BACKPROPAGATE, NUMBER_OF_PHASES};
+
+	SearchStatistics() :
+		number_of_threads(0),
+		unpinned_threads(0),
+		iterations(0),
+		nodes(0),
+		memory_bytes(0)
+	{
+		for (int p = 0; p < NUMBER_OF_PHASES; ++p) {
+			phase_ticks[p] = 0;
+			for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+				phase_counters[p][c] = 0;
+			}
+		}
+		for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+			has_counter[c] = false;
+		}
+	}
+
+	void merge(const SearchStatistics& other);
+	void print(std::ostream& out) const;
+	static const char* phase_name(int phase);
+
+	// Number of threads that searched. Zero if the move was returned
+	// without searching.
+	int number_of_threads;
+	// Number of threads that could not be pinned to their cores in
+	// ComputeOptions::thread_cores.
+	int unpinned_threads;
+	long long iterations;
+	// Number of nodes allocated.
+	long long nodes;
+	// Approximate memory used by the trees at the end of the search,
+	// which is also the peak since the trees only grow.
+	long long memory_bytes;
+	// Cycles (or clock ticks where there is no cycle counter)
+	// spent in each phase.
+	unsigned long long phase_ticks[NUMBER_OF_PHASES];
+	// Hardware counters for each phase, if has_counter is set.
+	unsigned long long phase_counters[NUMBER_OF_PHASES][PerfCounters::NUMBER_OF_COUNTERS];
+	bool has_counter[PerfCounters::NUMBER_OF_COUNTERS];
+	// Number of iterations that left the tree at each depth.
+	vector<long long> depth_histogram;
+};
+
+inline void SearchStatistics::merge(const SearchStatistics& other)
+{
+	number_of_threads += other.number_of_threads;
+	unpinned_threads += other.unpinned_threads;
+	iterations += other.iterations;
+	nodes += other.nodes;
+	memory_bytes += other.memory_bytes;
+	for (int p = 0; p < NUMBER_OF_PHASES; ++p) {
+		phase_ticks[p] += other.phase_ticks[p];
+		for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+			phase_counters[p][c] += other.phase_counters[p][c];
+		}
+	}
+	for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+		has_counter[c] = has_counter[c] || other.has_counter[c];
+	}
+	if (depth_histogram.size() < other.depth_histogram.size()) {
+		depth_histogram.resize(other.depth_histogram.size(), 0);
+	}
+	for (size_t d = 0; d < other.depth_histogram.size(); ++d) {
+		depth_histogram[d] += other.depth_histogram[d];
+	}
+}
+
+inline const char* SearchStatistics::phase_name(int phase)
+{
+	static const char* names[NUMBER_OF_PHASES] = {"select", "expand", "rollout", "backpropagate"};
+	return names[phase];
+}
+
+inline void SearchStatistics::print(std::ostream& out) const
+{
+	using namespace std;
+
+	unsigned long long total_ticks = 0;
+	for (int p = 0; p < NUMBER_OF_PHASES; ++p) {
+		total_ticks += phase_ticks[p];
+	}
+	out << iterations << " iterations and " << nodes << " nodes (" << memory_bytes / 1024 << " kB) in "
+	    << number_of_threads << " threads." << endl;
+	for (int p = 0; p < NUMBER_OF_PHASES; ++p) {
+		out << setw(14) << left << phase_name(p)
+		    << setw(12) << right << phase_ticks[p] / max(iterations, 1LL) << " ticks/iteration"
+		    << " (" << setw(2) << right << int(100.0 * phase_ticks[p] / max(total_ticks, 1ULL) + 0.5) << "%)" << endl;
+	}
+
+	// Hardware counters per iteration.
+	if (std::find(has_counter, has_counter + PerfCounters::NUMBER_OF_COUNTERS, true) != has_counter + PerfCounters::NUMBER_OF_COUNTERS) {
+		out << setw(14) << left << "per iteration";
+		for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+			if (has_counter[c]) {
+				out << setw(14) << right << PerfCounters::counter_name(c);
+			}
+		}
+		out << setw(8) << right << "IPC" << endl;
+		for (int p = 0; p < NUMBER_OF_PHASES; ++p) {
+			out << setw(14) << left << phase_name(p);
+			for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+				if (has_counter[c]) {
+					out << setw(14) << right << phase_counters[p][c] / max(iterations, 1LL);
+				}
+			}
+			double cycles = double(phase_counters[p][PerfCounters::CYCLES]);
+			double instructions = double(phase_counters[p][PerfCounters::INSTRUCTIONS]);
+			auto precision = out.precision();
+			out << setw(8) << right << fixed << setprecision(2)
+			    << (cycles > 0 ? instructions / cycles : 0.0) << endl;
+			out.unsetf(ios::floatfield);
+			out.precision(precision);
+		}
+	}
+
+	out << "Depth histogram:";
+	for (size_t d = 0; d < depth_histogram.size(); ++d) {
+		if (depth_histogram[d] > 0) {
+			out << " " << d << ":" << depth_histogram[d];
+		}
+	}
+	out << endl;
+}
+
+// Records SearchStatistics for one thread. Only the counts are
+// recorded unless MCTS_INSTRUMENTATION is defined.
+class SearchInstrumentation
+{
+public:
+	SearchInstrumentation(SearchStatistics* statistics_)
+		: statistics(statistics_)
+	{
+		statistics->number_of_threads = 1;
+		#ifdef MCTS_INSTRUMENTATION
+		last_ticks = read_ticks();
+		#endif
+		#ifdef MCTS_PERF_COUNTERS
+		for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+			statistics->has_counter[c] = counters.available(c);
+		}
+		counters.read(last_counts);
+		#endif
+	}
+
+	// Attributes the time since the last call to the given phase.
+	void end_phase(SearchStatistics::Phase phase)
+	{
+		#ifdef MCTS_INSTRUMENTATION
+		auto ticks = read_ticks();
+		statistics->phase_ticks[phase] += ticks - last_ticks;
+		last_ticks = ticks;
+		#endif
+		#ifdef MCTS_PERF_COUNTERS
+		unsigned long long counts[PerfCounters::NUMBER_OF_COUNTERS];
+		counters.read(counts);
+		for (int c = 0; c < PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+			// Scaled values of multiplexed counters may go backwards.
+			if (counts[c] > last_counts[c]) {
+				statistics->phase_counters[phase][c] += counts[c] - last_counts[c];
+			}
+			last_counts[c] = counts[c];
+		}
+		#endif
+	}
+
+	void end_iteration(std::size_t depth)
+	{
+		statistics->iterations++;
+		#ifdef MCTS_INSTRUMENTATION
+		if (statistics->depth_histogram.size() <= depth) {
+			statistics->depth_histogram.resize(depth + 1, 0);
+		}
+		statistics->depth_histogram[depth]++;
+		#endif
+	}
+
+	void add_node()
+	{
+		statistics->nodes++;
+	}
+
+	void set_memory(long long bytes)
+	{
+		statistics->memory_bytes = bytes;
+	}
+
+private:
+	#ifdef MCTS_INSTRUMENTATION
+	static unsigned long long read_ticks()
+	{
+		#ifdef MCTS_HAS_RDTSC
+		return __rdtsc();
+		#else
+		return std::chrono::high_resolution_clock::now().time_since_epoch().count();
+		#endif
+	}
+
+	unsigned long long last_ticks;
+	#endif
+
+	#ifdef MCTS_PERF_COUNTERS
+	PerfCounters counters;
+	unsigned long long last_counts[PerfCounters::NUMBER_OF_COUNTERS];
+	#endif
+
+	SearchStatistics* statistics;
+};
+
+// Continues the search in the tree of root, whose state is root_state.
+// The search ends when the budget in options is used up or when stop
+// is set.
+template<typename State, typename Policy = UCB1>
+void grow_tree(Node<State>* root,
+               const State& root_state,
+               const ComputeOptions& options,
+               std::mt19937_64::result_type initial_seed,
+               SearchStatistics* statistics = nullptr,
+               SharedRootStatistics<State>* shared = nullptr,
+               LeafEvaluator<State>* evaluator = nullptr,
+               const std::atomic<bool>* stop = nullptr)
+{
+	std::mt19937_64 random_engine(initial_seed);
+
+	// Searches that can be stopped may instead run until stopped.
+	attest(options.max_iterations >= 0 || options.max_time >= 0 ||
+	       shared != nullptr || stop != nullptr);
+	attest(options.expansion_threshold >= 1);
+	attest(options.playouts_per_leaf >= 1);
+	attest(options.exploration_constant >= 0);
+	if (options.max_rollout_depth >= 0 && ! HasEvaluate<State>::value) {
+		throw std::runtime_error("ComputeOptions::max_rollout_depth requires State::evaluate.");
+	}
+	if (evaluator != nullptr) {
+		attest(options.leaf_batch_size >= 1);
+		// RAVE needs the moves of the playouts.
+		attest( ! options.use_rave);
+	}
+	if (options.max_time >= 0) {
+		#ifndef USE_OPENMP
+		throw std::runtime_error("ComputeOptions::max_time requires OpenMP.");
+		#endif
+	}
+	// Will support more players later.
+	attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
+	SearchStatistics local_statistics;
+	SearchInstrumentation instrumentation(statistics ? statistics : &local_statistics);
+
+	attest(root->parent == nullptr && root->player_to_move == root_state.player_to_move);
+	if (root->visits == 0) {
+		instrumentation.add_node();
+		if (options.opening_book != nullptr && ! root->has_children()) {
+			int book_children = seed_root_from_book<State, Policy>(
+				root, root_state, *options.opening_book,
+				std::integral_constant<bool, SupportsOpeningBook<State>::value>());
+			for (int c = 0; c < book_children; ++c) {
+				instrumentation.add_node();
+			}
+		}
+	}
+	long long tree_memory = root->tree_memory_usage();
+	bool memory_exhausted = options.max_memory_bytes >= 0 && tree_memory >= options.max_memory_bytes;
+	// Adds memory allocated for the tree during iteration iter.
+	auto add_tree_memory = [&] (std::size_t bytes, int iter) -> void
+	{
+		tree_memory += bytes;
+		if ( ! memory_exhausted && options.max_memory_bytes >= 0 && tree_memory >= options.max_memory_bytes) {
+			memory_exhausted = true;
+			if (options.verbose) {
+				cerr << "Memory limit reached after " << iter << " games; "
+				     << "the tree will not be expanded further." << endl;
+			}
+		}
+	};
+
+	// Statistics of the other threads when they are shared. Without
+	// sync_interval, the statistics are only published.
+	int shared_slot = -1;
+	bool share_selection = options.sync_interval > 0;
+	int publish_interval = SharedRootStatistics<State>::default_publish_interval;
+	if (share_selection) {
+		publish_interval = options.sync_interval;
+	}
+	vector<MoveStatistics> others;
+	long long others_visits = 0;
+	vector<std::size_t> root_child_positions;
+	if (shared != nullptr) {
+		shared_slot = shared->add_thread();
+		for (auto child: root->children) {
+			root_child_positions.push_back(shared->get_move_index()(child->move));
+		}
+	}
+
+	#ifdef USE_OPENMP
+	double start_time = ::omp_get_wtime();
+	double print_time = start_time;
+	#endif
+
+	// The moves of each iteration are recorded here when RAVE is used.
+	// The buffer is reused between iterations.
+	typedef typename State::Move Move;
+	vector<PlayedMove<Move>> played;
+	if (options.use_rave) {
+		played.reserve(1000);
+	}
+
+	LeafBatch<State> batch;
 	State state;
+	State leaf_state;
+	int iterations = 0;
 	for (int iter = 1; iter <= options.max_iterations || options.max_iterations < 0; ++iter) {
-		auto node = root.get();
+		Trace* iteration_trace = nullptr;
+		if (options.trace != nullptr && options.trace->is_sampled(iter)) {
+			iteration_trace = options.trace;
+		}
+		TraceSpan iteration_span(iteration_trace, "iteration");
+		auto node = root;
 		state = root_state;
+		played.clear();
+		std::size_t tree_depth = 0;
 
 		// Select a path through the tree to a leaf node.
 		while (!node->has_untried_moves() && node->has_children()) {
-			node = node->select_child_UCT();
+			if (node == root && others_visits > 0) {
+				node = select_root_child_shared<Policy>(*root, root_child_positions, others, others_visits,
+				                                        options);
+			}
+			else {
+				node = Policy::select_child(*node, options);
+			}
+			if (options.prefetch) {
+				// Overlaps the loads of the next level with do_move.
+				prefetch(node->child_statistics.data());
+				prefetch(node->children.data());
+			}
+			if (options.use_rave) {
+				played.emplace_back(node->move, state.player_to_move);
+			}
 			state.do_move(node->move);
+			tree_depth++;
 		}
+		instrumentation.end_phase(SearchStatistics::SELECT);
 
 		// If we are not already at the final state, expand the
-		// tree with a new node and move there.
-		if (node->has_untried_moves()) {
+		// tree with a new node and move there. Leaves that have not
+		// been reached often enough are played out directly, as are
+		// all leaves once the memory budget is used up.
+		bool expand = node == root ||
+		              (node->visits + 1 >= options.expansion_threshold && ! memory_exhausted);
+		if (node->has_untried_moves() && expand) {
+			auto number_of_moves = node->moves.size() + node->children.size();
 			auto move = node->get_untried_move(&random_engine);
+			double prior = 1.0;
+			if (Policy::uses_priors) {
+				prior = get_move_prior(state, move, number_of_moves);
+			}
+			if (options.use_rave) {
+				played.emplace_back(move, state.player_to_move);
+			}
 			state.do_move(move);
+			if (node == root && shared != nullptr) {
+				root_child_positions.push_back(shared->get_move_index()(move));
+			}
 			node = node->add_child(move, state);
+			if (Policy::uses_variance) {
+				node->add_policy_statistics();
+			}
+			if (Policy::uses_priors) {
+				node->set_prior(prior);
+			}
+			instrumentation.add_node();
+			tree_depth++;
+
+			add_tree_memory(node->memory_usage(), iter);
 		}
+		auto depth = played.size();
+		instrumentation.end_phase(SearchStatistics::EXPAND);
+
+		if (evaluator != nullptr && state.has_moves()) {
+			// The leaf is evaluated together with other leaves later.
+			batch.add(node, state);
+			if (batch.size() >= std::size_t(options.leaf_batch_size)) {
+				batch.evaluate(evaluator);
+			}
+			instrumentation.end_phase(SearchStatistics::ROLLOUT);
+		}
+		else {
+			// We now play randomly until the game ends or max_rollout_depth
+			// moves have been made. This is repeated playouts_per_leaf
+			// times and the results are summed for each player.
+			if (options.playouts_per_leaf > 1) {
+				leaf_state = state;
+			}
+			double results[3] = {0.0, 0.0, 0.0};
+			double squared_results[3] = {0.0, 0.0, 0.0};
+			for (int playout = 0; playout < options.playouts_per_leaf; ++playout) {
+				if (playout > 0) {
+					state = leaf_state;
+					played.erase(played.begin() + depth, played.end());
+				}
+
+				bool finished = true;
+				int rollout_depth = 0;
+				if (options.use_rave) {
+					while (state.has_moves()) {
+						if (rollout_depth++ == options.max_rollout_depth) {
+							finished = false;
+							break;
+						}
+						auto player = state.player_to_move;
+						auto move = do_recorded_random_move(&state, &random_engine);
+						played.emplace_back(move, player);
+					}
+				}
+				else {
+					while (state.has_moves()) {
+						if (rollout_depth++ == options.max_rollout_depth) {
+							finished = false;
+							break;
+						}
+						state.do_random_move(&random_engine);
+					}
+				}
+
+				const double playout_results[3] = {0.0,
+				                                   playout_result(state, 1, finished),
+				                                   playout_result(state, 2, finished)};
+				results[1] += playout_results[1];
+				results[2] += playout_results[2];
+				squared_results[1] += playout_results[1] * playout_results[1];
+				squared_results[2] += playout_results[2] * playout_results[2];
+
+				if (options.use_rave) {
+					auto rave_depth = depth;
+					for (auto rave_node = node; rave_node != nullptr; rave_node = rave_node->parent) {
+						// Once the memory budget is used up, only the
+						// existing RAVE statistics are updated.
+						add_tree_memory(update_rave(rave_node, played, rave_depth, playout_results,
+						                            ! memory_exhausted), iter);
+						rave_depth--;
+					}
+				}
+			}
+			instrumentation.end_phase(SearchStatistics::ROLLOUT);
 
-		// We now play randomly until the game ends.
-		while (state.has_moves()) {
-			state.do_random_move(&random_engine);
+			// We have now reached a final state. Backpropagate the result
+			// up the tree to the root node.
+			while (node != nullptr) {
+				node->update(results[node->player_to_move], options.playouts_per_leaf,
+				             squared_results[node->player_to_move]);
+				node = node->parent;
+			}
 		}
+		instrumentation.end_phase(SearchStatistics::BACKPROPAGATE);
+		instrumentation.end_iteration(tree_depth);
 
-		// We have now reached a final state. Backpropagate the result
-		// up the tree to the root node.
-		while (node != nullptr) {
-			node->update(state.get_result(node->player_to_move));
-			node = node->parent;
+		iterations = iter;
+		if (shared != nullptr) {
+			if (iter % publish_interval == 0) {
+				if (share_selection) {
+					shared->exchange(shared_slot, *root, iterations, &others, &others_visits);
+				}
+				else {
+					shared->publish(shared_slot, *root, iterations);
+				}
+			}
+			if (shared->stop_requested()) {
+				break;
+			}
+		}
+		if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+			break;
 		}
 
 		#ifdef USE_OPENMP
@@ -367,89 +3347,238 @@ std::unique_ptr<Node<State>>  compute_tree(const State root_state,
 		#endif
 	}
 
+	// Evaluate the leaves that are still pending.
+	if (evaluator != nullptr) {
+		batch.evaluate(evaluator);
+	}
+
+	instrumentation.set_memory(tree_memory);
+
+	// Publish the final statistics.
+	if (shared != nullptr) {
+		shared->publish(shared_slot, *root, iterations);
+	}
+
+	#ifdef MCTS_INSTRUMENTATION
+	if (options.verbose) {
+		(statistics ? statistics : &local_statistics)->print(cerr);
+	}
+	#endif
+
+}
+
+template<typename State, typename Policy = UCB1>
+std::unique_ptr<Node<State>>  compute_tree(const State root_state,
+                                           const ComputeOptions options,
+                                           std::mt19937_64::result_type initial_seed,
+                                           SearchStatistics* statistics = nullptr,
+                                           SharedRootStatistics<State>* shared = nullptr,
+                                           LeafEvaluator<State>* evaluator = nullptr)
+{
+	auto root = std::unique_ptr<Node<State>>(new Node<State>(root_state));
+	grow_tree<State, Policy>(root.get(), root_state, options, initial_seed, statistics, shared, evaluator);
 	return root;
 }
 
+// The outcome of a search with compute_search_result.
 template<typename State>
-typename State::Move compute_move(const State root_state,
-                                  const ComputeOptions options)
+struct SearchResult
+{
+	typedef typename State::Move Move;
+
+	struct RootMove
+	{
+		Move move;
+		long long visits;
+		double wins;
+		// The principal variation starting with move. Only set for
+		// the first ComputeOptions::multi_pv root moves.
+		vector<Move> variation;
+	};
+
+	SearchResult() :
+		best_move(State::no_move),
+		from_book(false),
+		games_played(0),
+		seconds(0)
+	{ }
+
+	Move best_move;
+	// The best move was taken from the opening book without searching.
+	bool from_book;
+	// Statistics of the root moves summed over all threads, sorted by
+	// visits. Empty if there was no search.
+	vector<RootMove> root_moves;
+	// Starts with best_move, see principal_variation.
+	vector<Move> principal_variation;
+	// Visits of the roots, including those seeded from the book.
+	long long games_played;
+	// Wall time of the search.
+	double seconds;
+	// Iterations, nodes, peak memory and (with instrumentation) the
+	// time spent in each phase, summed over all threads.
+	SearchStatistics statistics;
+};
+
+// Searches like compute_move and returns the best move together with
+// the statistics of the search.
+template<typename State, typename Policy = UCB1>
+SearchResult<State> compute_search_result(const State root_state,
+                                          const ComputeOptions options = ComputeOptions(),
+                                          LeafEvaluator<State>* evaluator = nullptr)
 {
 	using namespace std;
 
 	// Will support more players later.
 	attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
 
+	SearchResult<State> result;
+	auto statistics = &result.statistics;
+	auto start = chrono::steady_clock::now();
+	auto elapsed = [&start] () -> double
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	};
 	auto moves = root_state.get_moves();
 	attest(moves.size() > 0);
 	if (moves.size() == 1) {
-		return moves[0];
+		result.best_move = moves[0];
+		result.principal_variation.push_back(moves[0]);
+		result.seconds = elapsed();
+		return result;
+	}
+
+	if (options.opening_book != nullptr && options.book_move_visits >= 0) {
+		typename State::Move book_move;
+		if (get_book_move(*options.opening_book, root_state, options.book_move_visits, &book_move)) {
+			if (options.verbose) {
+				cerr << "Book move: " << book_move << endl;
+			}
+			result.best_move = book_move;
+			result.from_book = true;
+			result.principal_variation.push_back(book_move);
+			result.seconds = elapsed();
+			return result;
+		}
 	}
 
 	#ifdef USE_OPENMP
 	double start_time = ::omp_get_wtime();
 	#endif
+	TraceSpan compute_span(options.trace, "compute_move");
 
-	// Start all jobs to compute trees.
+	// Start all jobs to compute trees. Each job also collects the
+	// statistics of its root children, indexed by root move.
+	RootMoveIndex<State> move_index(root_state, moves);
 	vector<future<unique_ptr<Node<State>>>> root_futures;
+	vector<SearchStatistics> thread_statistics(options.number_of_threads);
+	vector<vector<MoveStatistics>> thread_move_statistics(options.number_of_threads);
+	unique_ptr<SharedRootStatistics<State>> shared;
+	if (options.sync_interval > 0) {
+		shared.reset(new SharedRootStatistics<State>(move_index));
+	}
 	ComputeOptions job_options = options;
 	job_options.verbose = false;
+	if (options.max_memory_bytes >= 0) {
+		job_options.max_memory_bytes = options.max_memory_bytes / options.number_of_threads;
+	}
+	std::atomic<int> unpinned_threads(0);
 	for (int t = 0; t < options.number_of_threads; ++t) {
-		auto func = [t, &root_state, &job_options] () -> std::unique_ptr<Node<State>>
+		auto thread_statistics_t = &thread_statistics[t];
+		auto move_statistics_t = &thread_move_statistics[t];
+		auto shared_t = shared.get();
+		auto func = [&root_state, &move_index, thread_statistics_t, move_statistics_t, shared_t, evaluator]
+			(const ComputeOptions& thread_options, std::mt19937_64::result_type seed) -> std::unique_ptr<Node<State>>
 		{
-			return compute_tree(root_state, job_options, 1012411 * t + 12515);
+			std::unique_ptr<Node<State>> root;
+			{
+				TraceSpan span(thread_options.trace, "build tree");
+				root = compute_tree<State, Policy>(root_state, thread_options, seed,
+				                                   thread_statistics_t, shared_t, evaluator);
+			}
+			TraceSpan span(thread_options.trace, "collect statistics");
+			collect_root_statistics(*root, move_index, move_statistics_t);
+			return root;
 		};
 
-		root_futures.push_back(std::async(std::launch::async, func));
+		root_futures.push_back(start_search_thread(job_options, t, &unpinned_threads, func));
 	}
 
 	// Collect the results.
 	vector<unique_ptr<Node<State>>> roots;
-	for (int t = 0; t < options.number_of_threads; ++t) {
-		roots.push_back(std::move(root_futures[t].get()));
+	{
+		TraceSpan span(options.trace, "wait for threads");
+		for (int t = 0; t < options.number_of_threads; ++t) {
+			roots.push_back(std::move(root_futures[t].get()));
+		}
 	}
 
 	// Merge the children of all root nodes.
-	map<typename State::Move, int> visits;
-	map<typename State::Move, double> wins;
+	vector<MoveStatistics> move_statistics(move_index.size());
 	long long games_played = 0;
-	for (int t = 0; t < options.number_of_threads; ++t) {
-		auto root = roots[t].get();
-		games_played += root->visits;
-		for (auto child = root->children.cbegin(); child != root->children.cend(); ++child) {
-			visits[(*child)->move] += (*child)->visits;
-			wins[(*child)->move]   += (*child)->wins;
+	{
+		TraceSpan span(options.trace, "merge");
+		for (int t = 0; t < options.number_of_threads; ++t) {
+			statistics->merge(thread_statistics[t]);
+		}
+		statistics->unpinned_threads = unpinned_threads;
+		for (int t = 0; t < options.number_of_threads; ++t) {
+			games_played += roots[t]->visits;
+			for (size_t i = 0; i < move_index.size(); ++i) {
+				add_move_statistics(&move_statistics[i], thread_move_statistics[t][i]);
+			}
 		}
 	}
 
 	// Find the node with the highest score.
-	double best_score = -1;
-	typename State::Move best_move = typename State::Move();
-	for (auto itr: visits) {
-		auto move = itr.first;
-		double v = itr.second;
-		double w = wins[move];
-		// Expected success rate assuming a uniform prior (Beta(1, 1)).
-		// https://en.wikipedia.org/wiki/Beta_distribution
-		double expected_success_rate = (w + 1) / (v + 2);
-		if (expected_success_rate > best_score) {
-			best_move = move;
-			best_score = expected_success_rate;
-		}
+	size_t best_position = best_root_position(move_statistics);
+	auto best_move = move_index.move(best_position);
 
-		if (options.verbose) {
-			cerr << "Move: " << itr.first
-			     << " (" << setw(2) << right << int(100.0 * v / double(games_played) + 0.5) << "% visits)"
-			     << " (" << setw(2) << right << int(100.0 * w / v + 0.5)    << "% wins)" << endl;
+	result.best_move = best_move;
+	result.games_played = games_played;
+	for (size_t i = 0; i < move_index.size(); ++i) {
+		typename SearchResult<State>::RootMove root_move;
+		root_move.move = move_index.move(i);
+		root_move.visits = move_statistics[i].visits;
+		root_move.wins = move_statistics[i].wins;
+		result.root_moves.push_back(root_move);
+	}
+	stable_sort(result.root_moves.begin(), result.root_moves.end(),
+		[](const typename SearchResult<State>::RootMove& a, const typename SearchResult<State>::RootMove& b)
+		{
+			return a.visits > b.visits;
+		});
+	vector<const Node<State>*> root_nodes;
+	for (auto& root: roots) {
+		root_nodes.push_back(root.get());
+	}
+	result.principal_variation = principal_variation(root_nodes, best_move);
+	for (size_t i = 0; i < result.root_moves.size() && int(i) < options.multi_pv; ++i) {
+		auto& root_move = result.root_moves[i];
+		if (root_move.visits > 0) {
+			root_move.variation = principal_variation(root_nodes, root_move.move);
 		}
 	}
 
+	destroy_trees(&roots, options.reclaim_in_background, options.trace);
+
 	if (options.verbose) {
-		auto best_wins = wins[best_move];
-		auto best_visits = visits[best_move];
-		cerr << "----" << endl;
-		cerr << "Best: " << best_move
-		     << " (" << 100.0 * best_visits / double(games_played) << "% visits)"
-		     << " (" << 100.0 * best_wins / best_visits << "% wins)" << endl;
+		print_root_statistics(cerr, move_index, move_statistics, games_played, best_position);
+		print_unpinned_threads(cerr, statistics->unpinned_threads);
+		cerr << "Principal variation:";
+		for (auto& move: result.principal_variation) {
+			cerr << " " << move;
+		}
+		cerr << endl;
+		for (auto& root_move: result.root_moves) {
+			if ( ! root_move.variation.empty() && options.multi_pv > 1) {
+				cerr << "Line (" << root_move.visits << " visits):";
+				for (auto& move: root_move.variation) {
+					cerr << " " << move;
+				}
+				cerr << endl;
+			}
+		}
 	}
 
 	#ifdef USE_OPENMP
@@ -461,7 +3590,527 @@ typename State::Move compute_move(const State root_state,
 	}
 	#endif
 
-	return best_move;
+	#ifdef MCTS_INSTRUMENTATION
+	if (options.verbose) {
+		statistics->print(cerr);
+	}
+	#endif
+
+	result.seconds = elapsed();
+	return result;
+}
+
+template<typename State, typename Policy>
+typename State::Move compute_move(const State root_state,
+                                  const ComputeOptions options,
+                                  SearchStatistics* statistics,
+                                  LeafEvaluator<State>* evaluator)
+{
+	auto result = compute_search_result<State, Policy>(root_state, options, evaluator);
+	if (statistics != nullptr) {
+		*statistics = result.statistics;
+	}
+	return result.best_move;
+}
+
+// A search running in the background. The search starts when the
+// session is created and runs until the budget in the options is used
+// up or stop is called. The threads publish their root statistics
+// every sync_interval iterations (or every
+// SharedRootStatistics::default_publish_interval iterations if not
+// set), and the statistics can be queried at any time. Only with
+// sync_interval do the threads select root moves based on each
+// other's statistics. If both max_iterations and max_time are
+// negative, the search runs until stopped.
+template<typename State, typename Policy = UCB1>
+class SearchSession
+{
+public:
+	typedef typename State::Move Move;
+
+	SearchSession(const State& root_state, const ComputeOptions& options)
+		: moves(root_state.get_moves()),
+		  move_index(root_state, moves),
+		  shared(move_index),
+		  verbose(options.verbose),
+		  printed(false),
+		  unpinned(0)
+	{
+		// Will support more players later.
+		attest(root_state.player_to_move == 1 || root_state.player_to_move == 2);
+		attest(moves.size() > 0);
+		if (moves.size() == 1) {
+			return;
+		}
+
+		ComputeOptions job_options = options;
+		job_options.verbose = false;
+		if (options.max_memory_bytes >= 0) {
+			job_options.max_memory_bytes = options.max_memory_bytes / options.number_of_threads;
+		}
+		auto shared_statistics = &shared;
+		for (int t = 0; t < options.number_of_threads; ++t) {
+			auto func = [root_state, shared_statistics]
+				(const ComputeOptions& thread_options, std::mt19937_64::result_type seed) -> void
+			{
+				TraceSpan span(thread_options.trace, "build tree");
+				auto root = compute_tree<State, Policy>(root_state, thread_options, seed,
+				                                        nullptr, shared_statistics);
+				if (thread_options.reclaim_in_background) {
+					TreeReclaimer::instance().reclaim(std::move(root));
+				}
+			};
+			futures.push_back(start_search_thread(job_options, t, &unpinned, func));
+		}
+	}
+
+	~SearchSession()
+	{
+		shared.request_stop();
+		for (auto& future: futures) {
+			if (future.valid()) {
+				future.wait();
+			}
+		}
+	}
+
+	// Stops the search and waits for all threads. Exceptions thrown
+	// by the threads are rethrown here.
+	void stop()
+	{
+		shared.request_stop();
+		wait();
+	}
+
+	// Waits for the search to use up its budget. If verbose is set in
+	// the options, the final root statistics are printed.
+	void wait()
+	{
+		for (auto& future: futures) {
+			if (future.valid()) {
+				future.get();
+			}
+		}
+
+		if (verbose && ! printed && ! futures.empty()) {
+			printed = true;
+			vector<MoveStatistics> statistics;
+			auto games_played = shared.get_statistics(&statistics);
+			print_root_statistics(cerr, move_index, statistics, games_played,
+			                      best_root_position(statistics));
+			print_unpinned_threads(cerr, unpinned);
+		}
+	}
+
+	// Number of threads that could not be pinned to their cores in
+	// ComputeOptions::thread_cores.
+	int unpinned_threads() const
+	{
+		return unpinned;
+	}
+
+	bool is_running() const
+	{
+		for (auto& future: futures) {
+			if (future.valid() &&
+			    future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// The legal moves of the root state, in the order used by
+	// root_statistics.
+	const vector<Move>& root_moves() const
+	{
+		return moves;
+	}
+
+	// The combined root statistics of all threads, as last published.
+	vector<MoveStatistics> root_statistics() const
+	{
+		vector<MoveStatistics> statistics;
+		shared.get_statistics(&statistics);
+		return statistics;
+	}
+
+	// Total number of iterations of all threads, as last published.
+	long long iterations() const
+	{
+		vector<MoveStatistics> statistics;
+		return shared.get_statistics(&statistics);
+	}
+
+	// The move compute_move would return based on the statistics
+	// published so far. Before the threads have published anything,
+	// all statistics are zero and this is the first root move.
+	Move best_move_so_far() const
+	{
+		return moves[best_root_position(root_statistics())];
+	}
+
+private:
+	const vector<Move> moves;
+	const RootMoveIndex<State> move_index;
+	SharedRootStatistics<State> shared;
+	const bool verbose;
+	bool printed;
+	std::atomic<int> unpinned;
+	vector<std::future<void>> futures;
+};
+
+// Keeps the search trees between moves, so that the engine can search
+// while the opponent is thinking (pondering) and reuse the subtree of
+// the move that was played.
+//
+//     Ponderer<State> engine(state, options);
+//     ...
+//     engine.start_pondering();
+//     cin >> move;              // The opponent thinks.
+//     engine.do_move(move);     // Keeps the subtree of move.
+//     move = engine.compute_move();
+//     engine.do_move(move);
+//
+// compute_move continues the trees with the budget in options. The
+// pondering has no budget, so max_memory_bytes should be set if the
+// opponent may think for a long time. sync_interval is not used.
+template<typename State, typename Policy = UCB1>
+class Ponderer
+{
+public:
+	typedef typename State::Move Move;
+
+	Ponderer(const State& state_, const ComputeOptions& options_)
+		: state(state_),
+		  options(options_),
+		  stop(false),
+		  unpinned_threads(0),
+		  searches(0)
+	{
+		options.verbose = false;
+		if (options.max_memory_bytes >= 0) {
+			options.max_memory_bytes /= options.number_of_threads;
+		}
+		verbose = options_.verbose;
+		for (int t = 0; t < options.number_of_threads; ++t) {
+			roots.emplace_back(new Node<State>(state));
+		}
+	}
+
+	~Ponderer()
+	{
+		stop = true;
+		for (auto& future: futures) {
+			future.wait();
+		}
+	}
+
+	const State& get_state() const
+	{
+		return state;
+	}
+
+	// Searches from the current state in the background until
+	// stop_pondering, do_move or compute_move is called.
+	void start_pondering()
+	{
+		stop_pondering();
+		if ( ! state.has_moves()) {
+			return;
+		}
+		ComputeOptions ponder_options = options;
+		ponder_options.max_iterations = -1;
+		ponder_options.max_time = -1;
+		stop = false;
+		run(ponder_options, &stop);
+	}
+
+	void stop_pondering()
+	{
+		stop = true;
+		wait();
+	}
+
+	// Plays move and keeps the corresponding subtrees.
+	void do_move(const Move& move)
+	{
+		stop_pondering();
+		state.do_move(move);
+		for (auto& root: roots) {
+			auto child = root->release_child(move);
+			if ( ! child) {
+				child.reset(new Node<State>(state));
+			}
+			std::swap(root, child);
+			if (options.reclaim_in_background) {
+				TreeReclaimer::instance().reclaim(std::move(child));
+			}
+		}
+	}
+
+	// Continues the search with the budget in the options and
+	// returns the best move. The move is not played.
+	Move compute_move()
+	{
+		using namespace std;
+
+		stop_pondering();
+		auto moves = state.get_moves();
+		attest(moves.size() > 0);
+		if (moves.size() == 1) {
+			return moves[0];
+		}
+
+		#ifdef USE_OPENMP
+		double start_time = ::omp_get_wtime();
+		#endif
+		long long previous_games = 0;
+		for (auto& root: roots) {
+			previous_games += root->visits;
+		}
+
+		run(options, nullptr);
+		wait();
+
+		RootMoveIndex<State> move_index(state, moves);
+		vector<MoveStatistics> move_statistics(move_index.size());
+		long long games_played = 0;
+		for (auto& root: roots) {
+			games_played += root->visits;
+			collect_root_statistics(*root, move_index, &move_statistics);
+		}
+		size_t best_position = best_root_position(move_statistics);
+
+		if (verbose) {
+			print_root_statistics(cerr, move_index, move_statistics, games_played, best_position);
+			print_unpinned_threads(cerr, unpinned_threads.exchange(0));
+			cerr << previous_games << " games were reused from earlier searches." << endl;
+			#ifdef USE_OPENMP
+			double time = ::omp_get_wtime();
+			cerr << games_played - previous_games << " games played in " << double(time - start_time) << " s. "
+			     << "(" << double(games_played - previous_games) / (time - start_time) << " / second, "
+			     << options.number_of_threads << " parallel jobs)." << endl;
+			#endif
+		}
+
+		return move_index.move(best_position);
+	}
+
+private:
+	void run(const ComputeOptions& job_options, const std::atomic<bool>* stop_flag)
+	{
+		for (int t = 0; t < options.number_of_threads; ++t) {
+			auto root = roots[t].get();
+			auto root_state = &state;
+			auto func = [root, root_state, stop_flag]
+				(const ComputeOptions& thread_options, std::mt19937_64::result_type seed) -> void
+			{
+				TraceSpan span(thread_options.trace, "build tree");
+				grow_tree<State, Policy>(root, *root_state, thread_options, seed,
+				                         nullptr, nullptr, nullptr, stop_flag);
+			};
+			futures.push_back(start_search_thread(job_options, t, &unpinned_threads, func, 3571 * searches));
+		}
+		searches++;
+	}
+
+	// Waits for all threads. Exceptions thrown by the threads are
+	// rethrown here.
+	void wait()
+	{
+		for (auto& future: futures) {
+			future.get();
+		}
+		futures.clear();
+	}
+
+	State state;
+	ComputeOptions options;
+	bool verbose;
+	vector<std::unique_ptr<Node<State>>> roots;
+	std::atomic<bool> stop;
+	std::atomic<int> unpinned_threads;
+	vector<std::future<void>> futures;
+	int searches;
+};
+
+// Allocates the thinking time of one player over a game with a clock.
+// The remaining time is spread evenly over the moves expected to be
+// left, and each move gets the increment on top. compute_timed_move
+// may extend the budget of a move up to maximum_budget when the search
+// is unstable.
+class TimeManager
+{
+public:
+	TimeManager(double remaining_time_, double increment_ = 0.0, int expected_moves_ = 40)
+		: safety_margin(0.05),
+		  extension_factor(3.0),
+		  minimum_moves_left(5),
+		  remaining(remaining_time_),
+		  increment(increment_),
+		  expected_moves(expected_moves_),
+		  moves(0)
+	{
+		attest(remaining >= 0 && increment >= 0 && expected_moves >= 1);
+	}
+
+	// Budget for the next move, when the number of moves left is
+	// estimated from the expected length of the game.
+	double move_budget() const
+	{
+		return move_budget(expected_moves - moves);
+	}
+
+	// Budget for the next move when moves_left more moves (including
+	// this one) are expected, e.g. from the depth of the game.
+	double move_budget(int moves_left) const
+	{
+		moves_left = std::max(moves_left, minimum_moves_left);
+		return std::min(available_time() / moves_left + increment, available_time());
+	}
+
+	// Longest time the next move may use.
+	double maximum_budget() const
+	{
+		return maximum_budget(expected_moves - moves);
+	}
+
+	// Longest time the next move may use when moves_left more moves
+	// are expected.
+	double maximum_budget(int moves_left) const
+	{
+		return std::min(extension_factor * move_budget(moves_left), available_time());
+	}
+
+	// Updates the clock after a move that used the given time.
+	void move_made(double seconds)
+	{
+		remaining = std::max(0.0, remaining - seconds) + increment;
+		moves++;
+	}
+
+	double remaining_time() const
+	{
+		return remaining;
+	}
+
+	int moves_made() const
+	{
+		return moves;
+	}
+
+	// Fraction of the remaining time that is never allocated.
+	double safety_margin;
+	// The budget of a move may grow by this factor when the search
+	// is unstable.
+	double extension_factor;
+	// The remaining time is never spread over fewer moves than this.
+	int minimum_moves_left;
+
+private:
+	double available_time() const
+	{
+		return (1.0 - safety_margin) * remaining;
+	}
+
+	double remaining;
+	double increment;
+	int expected_moves;
+	int moves;
+};
+
+// Whether State can estimate the number of moves left in the game
+// for the player to move.
+template<typename State>
+struct HasMovesLeft
+{
+	template<typename S>
+	static auto test(int) -> decltype(int(std::declval<const S&>().moves_left()), std::true_type());
+	template<typename S>
+	static std::false_type test(...);
+	static const bool value = decltype(test<State>(0))::value;
+};
+
+// The number of moves left for the player to move according to
+// State::moves_left, or -1 if State has no estimate.
+template<typename State>
+int estimate_moves_left(const State& state, std::true_type)
+{
+	return state.moves_left();
+}
+
+template<typename State>
+int estimate_moves_left(const State&, std::false_type)
+{
+	return -1;
+}
+
+// Computes a move within the budget of the clock and updates the clock.
+// The search continues past TimeManager::move_budget, up to
+// TimeManager::maximum_budget, while the most visited move is not the
+// move with the best value. The limits on the number of iterations
+// and time in options are ignored.
+//
+// The budget is based on moves_left if positive, otherwise on
+// State::moves_left if available and otherwise on the expected length
+// of the game given to the TimeManager.
+template<typename State, typename Policy = UCB1>
+typename State::Move compute_timed_move(const State& root_state,
+                                        ComputeOptions options,
+                                        TimeManager* clock,
+                                        int moves_left = -1)
+{
+	using namespace std;
+
+	auto start = chrono::steady_clock::now();
+	auto elapsed = [&start] () -> double
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	};
+	if (moves_left <= 0) {
+		moves_left = estimate_moves_left(root_state, std::integral_constant<bool, HasMovesLeft<State>::value>());
+	}
+	double budget = clock->move_budget();
+	double maximum_budget = clock->maximum_budget();
+	if (moves_left > 0) {
+		budget = clock->move_budget(moves_left);
+		maximum_budget = clock->maximum_budget(moves_left);
+	}
+
+	options.max_iterations = -1;
+	options.max_time = -1;
+	SearchSession<State, Policy> session(root_state, options);
+	bool extended = false;
+	if (session.root_moves().size() > 1) {
+		while (true) {
+			this_thread::sleep_for(chrono::milliseconds(1));
+			double time = elapsed();
+			if (time < budget) {
+				continue;
+			}
+			if (time >= maximum_budget) {
+				break;
+			}
+			auto statistics = session.root_statistics();
+			if (session.iterations() > 0 &&
+			    most_visited_root_position(statistics) == best_root_position(statistics)) {
+				break;
+			}
+			extended = true;
+		}
+		session.stop();
+	}
+
+	auto move = session.best_move_so_far();
+	double used_time = elapsed();
+	clock->move_made(used_time);
+	if (options.verbose) {
+		cerr << "Used " << used_time << " s of " << budget << " s"
+		     << (extended ? " (extended)" : "") << ", "
+		     << clock->remaining_time() << " s left." << endl;
+	}
+	return move;
 }
 
 /////////////////////////////////////////////////////////
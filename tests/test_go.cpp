@@ -123,3 +123,22 @@ TEST_CASE("go3")
 	REQUIRE(move_set.find(GoState<M, N>::ij_to_ind(1, 0)) != move_set.end());
 }
 
+
+TEST_CASE("go_evaluate")
+{
+	static const int M = 3;
+	static const int N = 3;
+	char board[M][N+1] = {"21.",
+	                      "211",
+	                      ".1."};
+	auto state = GoState<M, N>(board);
+	// Player 1 is ahead.
+	CHECK(state.evaluate(2) > 0.5);
+	CHECK(state.evaluate(1) == Approx(1.0 - state.evaluate(2)));
+
+	MCTS::ComputeOptions options;
+	options.max_iterations = 100;
+	options.max_rollout_depth = 0;
+	auto tree = MCTS::compute_tree(GoState<5, 5>(), options, 1);
+	CHECK(tree->visits == 100);
+}
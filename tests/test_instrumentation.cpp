@@ -0,0 +1,49 @@
+// Petter Strandmark 2013.
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#ifndef MCTS_INSTRUMENTATION
+#define MCTS_INSTRUMENTATION
+#endif
+#include <mcts.h>
+
+#include "games/nim.h"
+
+using namespace std;
+
+TEST_CASE("instrumentation_compute_tree")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+
+	MCTS::SearchStatistics statistics;
+	auto tree = MCTS::compute_tree(NimState(21), options, 1, &statistics);
+
+	CHECK(statistics.number_of_threads == 1);
+	CHECK(statistics.iterations == 1000);
+	CHECK(statistics.nodes == 1001);
+	long long total = 0;
+	for (auto count: statistics.depth_histogram) {
+		total += count;
+	}
+	CHECK(total == 1000);
+	// The first iteration leaves the tree right below the root.
+	REQUIRE(statistics.depth_histogram.size() > 1);
+	CHECK(statistics.depth_histogram[0] == 0);
+	CHECK(statistics.phase_ticks[MCTS::SearchStatistics::ROLLOUT] > 0);
+}
+
+TEST_CASE("instrumentation_compute_move")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	options.number_of_threads = 3;
+
+	MCTS::SearchStatistics statistics;
+	MCTS::compute_move(NimState(21), options, &statistics);
+
+	CHECK(statistics.number_of_threads == 3);
+	CHECK(statistics.iterations == 3000);
+	CHECK(statistics.nodes == 3003);
+}
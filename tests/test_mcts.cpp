@@ -146,3 +146,933 @@ TEST_CASE("Nim")
 		}
 	}
 }
+
+TEST_CASE("RAVE")
+{
+	MCTS::ComputeOptions options;
+	options.use_rave = true;
+	options.number_of_threads = 2;
+
+	// TestGame::do_random_move does not return the move.
+	CHECK(MCTS::compute_move(TestGame(1), options) == 2);
+	CHECK(MCTS::compute_move(TestGame(2), options) == 1);
+
+	// Without a returned move, the recorded move is the one played.
+	std::mt19937_64 engine(1);
+	bool player_2_won = false;
+	bool player_1_won = false;
+	for (int game = 0; game < 100; ++game) {
+		TestGame state(2);
+		auto first_move = MCTS::do_recorded_random_move(&state, &engine);
+		REQUIRE((first_move == 1 || first_move == 2));
+		CHECK(state.player_to_move == 2);
+		CHECK((state.winner == 0) == (first_move == 1));
+		if (first_move == 2) {
+			auto second_move = MCTS::do_recorded_random_move(&state, &engine);
+			REQUIRE((second_move >= 1 && second_move <= 5));
+			CHECK(state.winner == (second_move == 1 ? 1 : 2));
+			player_1_won = player_1_won || second_move == 1;
+			player_2_won = player_2_won || second_move != 1;
+		}
+	}
+	CHECK(player_1_won);
+	CHECK(player_2_won);
+
+	// In TestGame, each move of a node is made at most once per game,
+	// so its RAVE statistics are those of the node itself.
+	options.max_iterations = 1000;
+	auto test_tree = MCTS::compute_tree(TestGame(1), options, 1);
+	vector<const MCTS::Node<TestGame>*> stack(test_tree->children.begin(), test_tree->children.end());
+	while ( ! stack.empty()) {
+		auto node = stack.back();
+		stack.pop_back();
+		CHECK(node->rave_visits() == node->visits);
+		CHECK(node->rave_wins() == Approx(node->wins));
+		stack.insert(stack.end(), node->children.begin(), node->children.end());
+	}
+
+	// In Nim, the moves of the playouts are also counted for the root
+	// children.
+	auto nim_tree = MCTS::compute_tree(NimState(21), options, 1);
+	long long rave_visits = 0;
+	for (auto child: nim_tree->children) {
+		CHECK(child->has_policy_statistics());
+		CHECK(child->rave_visits() >= child->visits);
+		rave_visits += child->rave_visits();
+	}
+	CHECK(rave_visits > nim_tree->visits);
+
+	// Searches without RAVE do not allocate the statistics.
+	options.use_rave = false;
+	auto plain_tree = MCTS::compute_tree(NimState(21), options, 1);
+	for (auto child: plain_tree->children) {
+		CHECK( ! child->has_policy_statistics());
+		CHECK(child->rave_visits() == 0);
+	}
+	CHECK(sizeof(MCTS::Node<NimState>) <= 128);
+}
+
+TEST_CASE("expansion_threshold")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 2000;
+
+	auto full_tree = MCTS::compute_tree(NimState(21), options, 1);
+	options.expansion_threshold = 5;
+	auto small_tree = MCTS::compute_tree(NimState(21), options, 1);
+
+	auto count_nodes = [](const MCTS::Node<NimState>* root) -> int
+	{
+		int count = 0;
+		vector<const MCTS::Node<NimState>*> stack(1, root);
+		while ( ! stack.empty()) {
+			auto node = stack.back();
+			stack.pop_back();
+			count++;
+			stack.insert(stack.end(), node->children.begin(), node->children.end());
+		}
+		return count;
+	};
+	CHECK(full_tree->visits == 2000);
+	CHECK(small_tree->visits == 2000);
+	CHECK(count_nodes(small_tree.get()) < count_nodes(full_tree.get()) / 2);
+
+	// Only nodes visited expansion_threshold times get children.
+	vector<const MCTS::Node<NimState>*> stack(small_tree->children.begin(), small_tree->children.end());
+	while ( ! stack.empty()) {
+		auto node = stack.back();
+		stack.pop_back();
+		if (node->has_children()) {
+			CHECK(node->visits >= 5);
+		}
+		stack.insert(stack.end(), node->children.begin(), node->children.end());
+	}
+}
+
+TEST_CASE("max_memory_bytes")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 5000;
+	options.max_memory_bytes = 20000;
+
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+	CHECK(tree->visits == 5000);
+	long long memory = 0;
+	vector<const MCTS::Node<NimState>*> stack(1, tree.get());
+	while ( ! stack.empty()) {
+		auto node = stack.back();
+		stack.pop_back();
+		memory += node->memory_usage();
+		stack.insert(stack.end(), node->children.begin(), node->children.end());
+	}
+	CHECK(memory < 2 * options.max_memory_bytes);
+
+	// The RAVE statistics allocated after the nodes also count.
+	options.use_rave = true;
+	auto rave_tree = MCTS::compute_tree(NimState(21), options, 1);
+	CHECK(rave_tree->visits == 5000);
+	CHECK(rave_tree->tree_memory_usage() < options.max_memory_bytes + 1000);
+
+	options.number_of_threads = 2;
+	CHECK(MCTS::compute_move(NimState(9), options) == 1);
+}
+
+TEST_CASE("root_move_index")
+{
+	static_assert(MCTS::MoveIndex<NimState>::is_dense, "NimState should have a dense move index.");
+	static_assert( ! MCTS::MoveIndex<TestGame>::is_dense, "TestGame should not have a dense move index.");
+
+	NimState nim(2);
+	MCTS::RootMoveIndex<NimState> nim_index(nim, nim.get_moves());
+	REQUIRE(nim_index.size() == 2);
+	CHECK(nim_index(1) == 0);
+	CHECK(nim_index(2) == 1);
+
+	TestGame game;
+	game.do_move(2);
+	auto moves = game.get_moves();
+	std::reverse(moves.begin(), moves.end());
+	MCTS::RootMoveIndex<TestGame> game_index(game, moves);
+	REQUIRE(game_index.size() == 5);
+	for (size_t i = 0; i < moves.size(); ++i) {
+		CHECK(game_index(moves[i]) == i);
+		CHECK(game_index.move(i) == moves[i]);
+	}
+}
+
+TEST_CASE("shared_root_statistics")
+{
+	NimState state(3);
+	auto moves = state.get_moves();
+	MCTS::RootMoveIndex<NimState> move_index(state, moves);
+	MCTS::SharedRootStatistics<NimState> shared(move_index);
+	int slot1 = shared.add_thread();
+	int slot2 = shared.add_thread();
+
+	MCTS::ComputeOptions options;
+	options.max_iterations = 100;
+	auto root1 = MCTS::compute_tree(state, options, 1);
+	auto root2 = MCTS::compute_tree(state, options, 2);
+
+	vector<MCTS::MoveStatistics> others;
+	long long others_visits = -1;
+	shared.exchange(slot1, *root1, 100, &others, &others_visits);
+	CHECK(others_visits == 0);
+	shared.exchange(slot2, *root2, 100, &others, &others_visits);
+	CHECK(others_visits == 100);
+	for (auto child: root1->children) {
+		CHECK(others[move_index(child->move)].visits == child->visits);
+		CHECK(others[move_index(child->move)].wins == child->wins);
+	}
+	vector<MCTS::MoveStatistics> all;
+	CHECK(shared.get_statistics(&all) == 200);
+
+	// Without statistics from the other threads, the selection at the
+	// root is that of the policy.
+	vector<size_t> child_positions;
+	for (auto child: root1->children) {
+		child_positions.push_back(move_index(child->move));
+	}
+	vector<MCTS::MoveStatistics> no_others(move_index.size());
+	CHECK(MCTS::select_root_child_shared<MCTS::UCB1>(*root1, child_positions, no_others, 0, options)
+	      == root1->select_child_UCT(options.exploration_constant));
+
+	auto positions_of = [&move_index] (const MCTS::Node<NimState>& root) -> vector<size_t>
+	{
+		vector<size_t> positions;
+		for (auto child: root.children) {
+			positions.push_back(move_index(child->move));
+		}
+		return positions;
+	};
+	MCTS::ComputeOptions policy_options;
+	policy_options.max_iterations = 100;
+	policy_options.exploration_constant = 10;
+	auto prior_root = MCTS::compute_tree<NimState, MCTS::PUCT>(state, policy_options, 1);
+	CHECK(MCTS::select_root_child_shared<MCTS::PUCT>(*prior_root, positions_of(*prior_root), no_others, 0, policy_options)
+	      == MCTS::PUCT::select_child(*prior_root, policy_options));
+	auto tuned_root = MCTS::compute_tree<NimState, MCTS::UCB1Tuned>(state, policy_options, 1);
+	CHECK(MCTS::select_root_child_shared<MCTS::UCB1Tuned>(*tuned_root, positions_of(*tuned_root), no_others, 0, policy_options)
+	      == MCTS::UCB1Tuned::select_child(*tuned_root, policy_options));
+	policy_options.use_rave = true;
+	auto rave_root = MCTS::compute_tree(state, policy_options, 1);
+	CHECK(MCTS::select_root_child_shared<MCTS::UCB1>(*rave_root, positions_of(*rave_root), no_others, 0, policy_options)
+	      == MCTS::UCB1::select_child(*rave_root, policy_options));
+
+	// Overwhelming statistics from the other threads decide the
+	// selection, whatever the statistics of the own root.
+	for (auto target: root1->children) {
+		vector<MCTS::MoveStatistics> strong_others(move_index.size());
+		for (auto child: root1->children) {
+			auto& other = strong_others[move_index(child->move)];
+			other.visits = 1000000;
+			other.wins = child == target ? 1000000 : 0;
+		}
+		CHECK(MCTS::select_root_child_shared<MCTS::UCB1>(*root1, child_positions, strong_others, 3000000,
+		                                                 options) == target);
+	}
+
+	// All threads finish their budgets when synchronizing.
+	options.sync_interval = 10;
+	options.number_of_threads = 4;
+	auto result = MCTS::compute_search_result(NimState(11), options);
+	CHECK(result.statistics.iterations == 400);
+	CHECK(result.games_played == 400);
+}
+
+TEST_CASE("playouts_per_leaf")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	options.playouts_per_leaf = 4;
+
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+	CHECK(tree->visits == 4000);
+	int child_visits = 0;
+	for (auto child: tree->children) {
+		child_visits += child->visits;
+		CHECK((child->visits % 4) == 0);
+	}
+	CHECK(child_visits == 4000);
+
+	// Every node of the tree gets all playouts of a leaf at once, also
+	// when RAVE records the moves of each playout.
+	options.use_rave = true;
+	auto rave_tree = MCTS::compute_tree(NimState(21), options, 1);
+	CHECK(rave_tree->visits == 4000);
+	vector<const MCTS::Node<NimState>*> stack(1, rave_tree.get());
+	while ( ! stack.empty()) {
+		auto node = stack.back();
+		stack.pop_back();
+		CHECK((node->visits % 4) == 0);
+		stack.insert(stack.end(), node->children.begin(), node->children.end());
+	}
+}
+
+TEST_CASE("uct_argmax")
+{
+	std::mt19937 engine(1);
+	std::uniform_int_distribution<int> visits_distribution(1, 100);
+	std::uniform_real_distribution<double> fraction_distribution(0.0, 1.0);
+
+	for (size_t n = 1; n <= 20; ++n) {
+		vector<double> wins(n), visits(n), statistics;
+		for (size_t i = 0; i < n; ++i) {
+			visits[i] = visits_distribution(engine);
+			wins[i] = std::floor(fraction_distribution(engine) * visits[i]);
+		}
+		// Create ties.
+		if (n > 5) {
+			wins[n - 1] = wins[1];
+			visits[n - 1] = visits[1];
+		}
+
+		double exploration = 2.0 * std::log(1000.0);
+		size_t expected = 0;
+		for (size_t i = 1; i < n; ++i) {
+			double expected_score = wins[expected] / visits[expected] + std::sqrt(exploration / visits[expected]);
+			double score = wins[i] / visits[i] + std::sqrt(exploration / visits[i]);
+			if (score > expected_score) {
+				expected = i;
+			}
+		}
+		for (size_t i = 0; i < n; ++i) {
+			statistics.push_back(wins[i]);
+			statistics.push_back(visits[i]);
+		}
+		CHECK(MCTS::uct_argmax(statistics.data(), n, exploration) == expected);
+	}
+}
+
+// Nim with a prior that prefers taking a single chip.
+class PriorNimState : public NimState
+{
+public:
+	PriorNimState(int chips_ = 17)
+		: NimState(chips_)
+	{ }
+
+	double get_prior(Move move) const
+	{
+		return move == 1 ? 0.9 : 0.05;
+	}
+};
+
+TEST_CASE("policies")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+
+	// UCB1Tuned sums the squared results, which are the results
+	// themselves in Nim.
+	auto tuned_tree = MCTS::compute_tree<NimState, MCTS::UCB1Tuned>(NimState(21), options, 1);
+	CHECK(tuned_tree->visits == 1000);
+	vector<const MCTS::Node<NimState>*> stack(tuned_tree->children.begin(), tuned_tree->children.end());
+	while ( ! stack.empty()) {
+		auto node = stack.back();
+		stack.pop_back();
+		REQUIRE(node->has_policy_statistics());
+		CHECK(node->wins_squared() == Approx(node->wins));
+		stack.insert(stack.end(), node->children.begin(), node->children.end());
+	}
+
+	// When exploration dominates, PUCT spreads the visits according to
+	// the priors.
+	options.max_iterations = 30;
+	options.exploration_constant = 100;
+	auto uniform_tree = MCTS::compute_tree<NimState, MCTS::PUCT>(NimState(21), options, 1);
+	for (auto child: uniform_tree->children) {
+		CHECK(child->prior() == Approx(1.0 / 3.0));
+		CHECK(child->visits <= 12);
+	}
+	auto prior_tree = MCTS::compute_tree<PriorNimState, MCTS::PUCT>(PriorNimState(21), options, 1);
+	REQUIRE(prior_tree->children.size() == 3);
+	for (auto child: prior_tree->children) {
+		if (child->move == 1) {
+			CHECK(child->prior() == Approx(0.9));
+			CHECK(child->visits > 20);
+		}
+		else {
+			CHECK(child->prior() == Approx(0.05));
+		}
+	}
+	CHECK(MCTS::PUCT::select_child(*prior_tree, options)->move == 1);
+
+	// The policies also work without exploration.
+	options.exploration_constant = 0;
+	options.max_iterations = 1000;
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+	CHECK(tree->visits == 1000);
+	tuned_tree = MCTS::compute_tree<NimState, MCTS::UCB1Tuned>(NimState(21), options, 1);
+	CHECK(tuned_tree->visits == 1000);
+	auto puct_tree = MCTS::compute_tree<NimState, MCTS::PUCT>(NimState(21), options, 1);
+	CHECK(puct_tree->visits == 1000);
+}
+
+TEST_CASE("max_rollout_depth")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 100;
+	options.max_rollout_depth = 10;
+	// NimState can not evaluate unfinished games.
+	CHECK_THROWS(MCTS::compute_tree(NimState(21), options, 1));
+}
+
+// Records the root statistics when the leaves are evaluated.
+class RecordingEvaluator : public MCTS::LeafEvaluator<NimState>
+{
+public:
+	RecordingEvaluator()
+		: root(nullptr)
+	{ }
+
+	void evaluate(const NimState*, std::size_t count, double* values) override
+	{
+		batch_sizes.push_back(count);
+		root_visits.push_back(root->visits);
+		double wins = 0;
+		for (auto child: root->children) {
+			wins += child->wins;
+		}
+		child_wins.push_back(wins);
+		for (std::size_t i = 0; i < count; ++i) {
+			values[i] = 1.0;
+		}
+	}
+
+	const MCTS::Node<NimState>* root;
+	vector<std::size_t> batch_sizes;
+	vector<int> root_visits;
+	vector<double> child_wins;
+};
+
+TEST_CASE("leaf_evaluator")
+{
+	MCTS::PlayoutEvaluator<NimState> evaluator;
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1001;
+	options.leaf_batch_size = 10;
+
+	// All pending leaves are evaluated before returning.
+	auto tree = MCTS::compute_tree<NimState>(NimState(21), options, 1, nullptr, nullptr, &evaluator);
+	CHECK(tree->visits == 1001);
+	double child_wins = 0;
+	for (auto child: tree->children) {
+		child_wins += child->wins;
+	}
+	CHECK(child_wins > 0);
+	CHECK(child_wins < 1001);
+
+	// The leaves waiting in a batch count as visits without wins.
+	RecordingEvaluator recording_evaluator;
+	std::unique_ptr<MCTS::Node<NimState>> root(new MCTS::Node<NimState>(NimState(21)));
+	recording_evaluator.root = root.get();
+	options.max_iterations = 25;
+	MCTS::grow_tree<NimState>(root.get(), NimState(21), options, 1, nullptr, nullptr, &recording_evaluator);
+	REQUIRE(recording_evaluator.batch_sizes.size() == 3);
+	CHECK(recording_evaluator.batch_sizes[0] == 10);
+	CHECK(recording_evaluator.batch_sizes[1] == 10);
+	CHECK(recording_evaluator.batch_sizes[2] == 5);
+	CHECK(recording_evaluator.root_visits[0] == 10);
+	CHECK(recording_evaluator.root_visits[1] == 20);
+	CHECK(recording_evaluator.root_visits[2] == 25);
+	CHECK(recording_evaluator.child_wins[0] == 0);
+	CHECK(root->visits == 25);
+
+	// The threads share the evaluator.
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+	auto result = MCTS::compute_search_result(NimState(21), options, &evaluator);
+	CHECK(result.games_played == 2000);
+}
+
+TEST_CASE("search_session")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 10000;
+	options.sync_interval = 100;
+
+	MCTS::SearchSession<NimState> session(NimState(7), options);
+	session.wait();
+	CHECK( ! session.is_running());
+	CHECK(session.iterations() == 20000);
+	CHECK(session.best_move_so_far() == 3);
+	auto statistics = session.root_statistics();
+	REQUIRE(statistics.size() == session.root_moves().size());
+	long long visits = 0;
+	for (auto& move_statistics: statistics) {
+		visits += move_statistics.visits;
+	}
+	CHECK(visits == 20000);
+
+	// Without a budget, the search runs until stopped.
+	options.max_iterations = -1;
+	MCTS::SearchSession<NimState> unlimited_session(NimState(21), options);
+	while (unlimited_session.iterations() < 1000) {
+		std::this_thread::yield();
+	}
+	CHECK(unlimited_session.is_running());
+	unlimited_session.stop();
+	CHECK( ! unlimited_session.is_running());
+	CHECK(unlimited_session.iterations() >= 1000);
+
+	// Without sync_interval, the statistics are published but each
+	// thread searches exactly as a thread of its own would.
+	options.max_iterations = 3000;
+	options.sync_interval = 0;
+	MCTS::SearchSession<NimState> independent_session(NimState(21), options);
+	independent_session.wait();
+	CHECK(independent_session.iterations() == 6000);
+	auto root_moves = independent_session.root_moves();
+	vector<int> expected_visits(root_moves.size(), 0);
+	for (int t = 0; t < 2; ++t) {
+		auto root = MCTS::compute_tree<NimState>(NimState(21), options, 1012411 * t + 12515);
+		for (auto child: root->children) {
+			auto position = std::find(root_moves.begin(), root_moves.end(), child->move) - root_moves.begin();
+			expected_visits[position] += child->visits;
+		}
+	}
+	auto independent_statistics = independent_session.root_statistics();
+	REQUIRE(independent_statistics.size() == root_moves.size());
+	for (std::size_t i = 0; i < root_moves.size(); ++i) {
+		CHECK(independent_statistics[i].visits == expected_visits[i]);
+	}
+
+	// With verbose, the final root statistics are printed once.
+	options.verbose = true;
+	stringstream sout;
+	auto cerr_buffer = cerr.rdbuf(sout.rdbuf());
+	MCTS::SearchSession<NimState> verbose_session(NimState(21), options);
+	verbose_session.wait();
+	verbose_session.stop();
+	cerr.rdbuf(cerr_buffer);
+	auto printed = sout.str();
+	auto best = printed.find("Best:");
+	CHECK(best != string::npos);
+	CHECK(printed.find("Best:", best + 1) == string::npos);
+}
+
+TEST_CASE("ponderer")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+
+	// Trees can be continued and their subtrees detached.
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+	MCTS::grow_tree(tree.get(), NimState(21), options, 2);
+	CHECK(tree->visits == 2000);
+	auto number_of_children = tree->children.size();
+	auto child_visits = tree->children[0]->visits;
+	auto child = tree->release_child(tree->children[0]->move);
+	REQUIRE(child);
+	CHECK( ! child->parent);
+	CHECK(child->visits == child_visits);
+	CHECK(tree->children.size() == number_of_children - 1);
+	for (size_t c = 0; c < tree->children.size(); ++c) {
+		CHECK(tree->child_statistics[2 * c + 1] == tree->children[c]->visits);
+	}
+	CHECK_FALSE(tree->release_child(child->move));
+
+	NimState state(11);
+	MCTS::Ponderer<NimState> engine(state, options);
+	auto move = engine.compute_move();
+	CHECK(move == 3);
+	engine.do_move(move);
+	engine.start_pondering();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	engine.do_move(1);
+	CHECK(engine.compute_move() == 3);
+}
+
+// Nim that estimates the number of moves left for the clock.
+class ShortNimState : public NimState
+{
+public:
+	ShortNimState(int chips_ = 17)
+		: NimState(chips_)
+	{ }
+
+	int moves_left() const
+	{
+		return 1;
+	}
+};
+
+TEST_CASE("time_manager")
+{
+	MCTS::TimeManager clock(100.0, 1.0, 20);
+	clock.safety_margin = 0;
+	CHECK(clock.move_budget() == Approx(100.0 / 20 + 1.0));
+	CHECK(clock.move_budget(2) == Approx(100.0 / 5 + 1.0));
+	CHECK(clock.maximum_budget() == Approx(3 * (100.0 / 20 + 1.0)));
+	clock.move_made(10.0);
+	CHECK(clock.remaining_time() == Approx(91.0));
+	CHECK(clock.moves_made() == 1);
+	CHECK(clock.move_budget() == Approx(91.0 / 19 + 1.0));
+	// The budget never exceeds the remaining time.
+	MCTS::TimeManager short_clock(1.0, 10.0);
+	CHECK(short_clock.move_budget() <= 1.0);
+	CHECK(short_clock.maximum_budget() <= 1.0);
+
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	MCTS::TimeManager nim_clock(2.0, 0.0, 10);
+	CHECK(MCTS::compute_timed_move(NimState(7), options, &nim_clock) == 3);
+	CHECK(nim_clock.remaining_time() < 2.0);
+	CHECK(nim_clock.moves_made() == 1);
+
+	// A short game gets a larger share of the remaining time. The
+	// budget of 1.9 / 1000 seconds grows to at least 1.9 / 5 seconds.
+	MCTS::TimeManager long_game_clock(2.0, 0.0, 1000);
+	CHECK(MCTS::compute_timed_move(NimState(7), options, &long_game_clock, 2) == 3);
+	CHECK(long_game_clock.remaining_time() <= 2.0 - 1.9 / 5);
+
+	MCTS::TimeManager estimated_clock(2.0, 0.0, 1000);
+	CHECK(MCTS::compute_timed_move(ShortNimState(7), options, &estimated_clock) == 3);
+	CHECK(estimated_clock.remaining_time() <= 2.0 - 1.9 / 5);
+}
+
+TEST_CASE("opening_book")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 10000;
+	NimState state(7);
+	auto tree = MCTS::compute_tree(state, options, 1);
+
+	MCTS::OpeningBookBuilder builder;
+	builder.add_tree(*tree, state, 2);
+	const char* file_name = "test_opening_book.bin";
+	builder.write(file_name);
+
+	{
+		MCTS::OpeningBook book(file_name);
+		CHECK(book.size() == builder.size());
+		auto range = book.find(state.hash());
+		REQUIRE((range.second - range.first) == 3);
+		long long visits = 0;
+		for (auto entry = range.first; entry != range.second; ++entry) {
+			visits += entry->visits;
+		}
+		CHECK(visits == 10000);
+
+		NimState::Move move = NimState::no_move;
+		CHECK(MCTS::get_book_move(book, state, 10000, &move));
+		CHECK(move == 3);
+		CHECK_FALSE(MCTS::get_book_move(book, state, 10001, &move));
+		CHECK_FALSE(MCTS::get_book_move(book, NimState(21), 0, &move));
+
+		// The search starts from the statistics of the book.
+		options.opening_book = &book;
+		options.max_iterations = 100;
+		auto seeded_tree = MCTS::compute_tree(state, options, 2);
+		CHECK(seeded_tree->visits == 10100);
+		CHECK(seeded_tree->children.size() == 3);
+
+		// The book is counted once, whatever the number of threads.
+		for (int threads = 1; threads <= 4; threads *= 2) {
+			options.number_of_threads = threads;
+			auto result = MCTS::compute_search_result(state, options);
+			CHECK(result.games_played == 10000 + 100 * threads);
+			CHECK(result.statistics.iterations == 100 * threads);
+		}
+
+		options.number_of_threads = 2;
+		options.book_move_visits = 0;
+		CHECK(MCTS::compute_move(state, options) == 3);
+		auto book_result = MCTS::compute_search_result(state, options);
+		CHECK(book_result.from_book);
+		CHECK(book_result.games_played == 0);
+		CHECK(book_result.statistics.number_of_threads == 0);
+		CHECK(book_result.seconds >= 0);
+
+		// States without a hash can not use the book.
+		CHECK_THROWS(MCTS::compute_move(TestGame(), options));
+	}
+
+	// The squared results of the book are used by UCB1Tuned, also
+	// with draws. A win and a draw have the squared results 1.25.
+	MCTS::OpeningBookBuilder draw_builder;
+	draw_builder.add(state.hash(), 3, 2, 1.5, 1.25);
+	draw_builder.write(file_name);
+	{
+		MCTS::OpeningBook book(file_name);
+		MCTS::Node<NimState> root(state);
+		CHECK((MCTS::seed_root_from_book<NimState, MCTS::UCB1Tuned>(&root, state, book, std::true_type()) == 1));
+		REQUIRE(root.children.size() == 1);
+		CHECK(root.children[0]->wins == 1.5);
+		CHECK(root.children[0]->wins_squared() == 1.25);
+	}
+
+	// Trees that sum the squared results write them to the book.
+	options = MCTS::ComputeOptions();
+	options.max_iterations = 1000;
+	auto tuned_tree = MCTS::compute_tree<NimState, MCTS::UCB1Tuned>(state, options, 1);
+	MCTS::OpeningBookBuilder tuned_builder;
+	tuned_builder.add_tree(*tuned_tree, state, 1);
+	tuned_builder.write(file_name);
+	{
+		MCTS::OpeningBook book(file_name);
+		auto range = book.find(state.hash());
+		for (auto entry = range.first; entry != range.second; ++entry) {
+			for (auto child: tuned_tree->children) {
+				if (child->move == entry->move) {
+					CHECK(entry->wins_squared == child->wins_squared());
+				}
+			}
+		}
+	}
+	std::remove(file_name);
+}
+
+TEST_CASE("tree_writer")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+
+	// Counts the nodes that the writer should write.
+	std::function<int(const MCTS::Node<NimState>&, int, int, int)> count_nodes =
+		[&count_nodes](const MCTS::Node<NimState>& node, int depth, int max_depth, int minimum_visits)
+		{
+			int count = 1;
+			if (depth + 1 < max_depth) {
+				for (auto child: node.children) {
+					if (child->visits >= minimum_visits) {
+						count += count_nodes(*child, depth + 1, max_depth, minimum_visits);
+					}
+				}
+			}
+			return count;
+		};
+
+	auto text = tree->tree_to_string(3);
+	CHECK(text.substr(0, text.find('\n') + 1) == tree->to_string());
+	CHECK(std::count(text.begin(), text.end(), '\n') == count_nodes(*tree, 0, 3, 0));
+	CHECK(text.find("| | [") != std::string::npos);
+	CHECK(text.find("| | | [") == std::string::npos);
+
+	stringstream json;
+	MCTS::TreeWriter<NimState> json_writer(json, MCTS::TreeWriter<NimState>::JSON);
+	json_writer.minimum_visits = 10;
+	json_writer.write(*tree);
+	auto json_string = json.str();
+	CHECK(json_string.substr(0, 10) == "{\"move\":-1");
+	CHECK(std::count(json_string.begin(), json_string.end(), '{') == count_nodes(*tree, 0, 1000000, 10));
+	CHECK(std::count(json_string.begin(), json_string.end(), '{') == std::count(json_string.begin(), json_string.end(), '}'));
+	CHECK(json_string.find(",,") == std::string::npos);
+	CHECK(json_string.find("}{") == std::string::npos);
+
+	stringstream binary;
+	MCTS::TreeWriter<NimState> binary_writer(binary, MCTS::TreeWriter<NimState>::BINARY);
+	binary_writer.max_depth = 2;
+	binary_writer.write(*tree);
+	CHECK(binary.str().size() == 8 + 32 * (1 + tree->children.size()));
+}
+
+TEST_CASE("tree_destruction")
+{
+	// A chain deep enough to overflow the stack if the tree were
+	// destroyed recursively.
+	const int depth = 200000;
+	NimState state(3 * depth);
+	std::unique_ptr<MCTS::Node<NimState>> root(new MCTS::Node<NimState>(state));
+	auto node = root.get();
+	for (int i = 0; i < depth; ++i) {
+		state.do_move(1);
+		node = node->add_child(1, state);
+	}
+	// The size of the tree is also computed iteratively.
+	CHECK(root->tree_memory_usage() > depth * sizeof(MCTS::Node<NimState>));
+	root.reset();
+
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+	options.reclaim_in_background = true;
+	auto move = MCTS::compute_move(NimState(21), options);
+	CHECK(move == 1);
+	MCTS::TreeReclaimer::instance().reclaim(MCTS::compute_tree(NimState(21), options, 1));
+	MCTS::TreeReclaimer::instance().wait();
+}
+
+TEST_CASE("thread_cores")
+{
+	CHECK(MCTS::parse_core_list("").empty());
+	CHECK((MCTS::parse_core_list("3") == vector<int>({3})));
+	CHECK((MCTS::parse_core_list("0-2,5,7-8") == vector<int>({0, 1, 2, 5, 7, 8})));
+	CHECK_THROWS(MCTS::parse_core_list("1-"));
+	CHECK_THROWS(MCTS::parse_core_list("2-1"));
+	CHECK_THROWS(MCTS::parse_core_list("a"));
+	CHECK_THROWS(MCTS::parse_core_list("1,,2"));
+
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+	options.thread_cores = MCTS::parse_core_list("0");
+	auto result = MCTS::compute_search_result(NimState(21), options);
+	CHECK(result.best_move == 1);
+	#ifdef MCTS_HAS_AFFINITY
+		CHECK(result.statistics.unpinned_threads == 0);
+	#endif
+
+	// Threads that can not be pinned are reported.
+	options.thread_cores = MCTS::parse_core_list("100000");
+	result = MCTS::compute_search_result(NimState(21), options);
+	CHECK(result.best_move == 1);
+	CHECK(result.statistics.unpinned_threads == 2);
+	MCTS::SearchSession<NimState> session(NimState(21), options);
+	session.wait();
+	CHECK(session.unpinned_threads() == 2);
+}
+
+TEST_CASE("prefetch")
+{
+	// Prefetching does not change the search.
+	for (bool use_rave: {false, true}) {
+		MCTS::ComputeOptions options;
+		options.max_iterations = 2000;
+		options.use_rave = use_rave;
+		auto with_prefetch = MCTS::compute_tree(NimState(50), options, 1);
+		options.prefetch = false;
+		auto without_prefetch = MCTS::compute_tree(NimState(50), options, 1);
+		CHECK(with_prefetch->to_string() == without_prefetch->to_string());
+		CHECK(with_prefetch->tree_to_string(2) == without_prefetch->tree_to_string(2));
+	}
+}
+
+TEST_CASE("perf_counters")
+{
+	MCTS::PerfCounters counters;
+	unsigned long long before[MCTS::PerfCounters::NUMBER_OF_COUNTERS];
+	unsigned long long after[MCTS::PerfCounters::NUMBER_OF_COUNTERS];
+	counters.read(before);
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	MCTS::compute_tree(NimState(21), options, 1);
+	counters.read(after);
+	for (int c = 0; c < MCTS::PerfCounters::NUMBER_OF_COUNTERS; ++c) {
+		if (counters.available(c)) {
+			CHECK(after[c] >= before[c]);
+		}
+		else {
+			CHECK(after[c] == 0);
+		}
+	}
+	if (counters.available(MCTS::PerfCounters::INSTRUCTIONS)) {
+		CHECK(after[MCTS::PerfCounters::INSTRUCTIONS] > before[MCTS::PerfCounters::INSTRUCTIONS]);
+	}
+	CHECK(std::string(MCTS::PerfCounters::counter_name(MCTS::PerfCounters::CYCLES)) == "cycles");
+}
+
+TEST_CASE("trace")
+{
+	MCTS::Trace trace(100);
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+	options.trace = &trace;
+	MCTS::compute_move(NimState(21), options);
+
+	stringstream sout;
+	trace.write(sout);
+	auto json = sout.str();
+	auto count = [&json](const std::string& pattern)
+	{
+		int n = 0;
+		for (auto pos = json.find(pattern); pos != std::string::npos; pos = json.find(pattern, pos + 1)) {
+			n++;
+		}
+		return n;
+	};
+	CHECK(json.substr(0, 15) == "{\"traceEvents\":");
+	CHECK(count("\"ph\":\"X\"") == int(trace.size()));
+	CHECK(count("\"name\":\"compute_move\"") == 1);
+	CHECK(count("\"name\":\"build tree\"") == 2);
+	CHECK(count("\"name\":\"merge\"") == 1);
+	CHECK(count("\"name\":\"destroy tree\"") == 2);
+	CHECK(count("\"name\":\"iteration\"") == 20);
+	CHECK(count("\"ph\":\"M\"") >= 3);
+	CHECK(std::count(json.begin(), json.end(), '{') == std::count(json.begin(), json.end(), '}'));
+}
+
+TEST_CASE("search_result")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+	auto result = MCTS::compute_search_result(NimState(21), options);
+	CHECK(result.best_move == 1);
+	CHECK( ! result.from_book);
+	REQUIRE(result.root_moves.size() == 3);
+	long long visits = 0;
+	for (size_t i = 0; i < result.root_moves.size(); ++i) {
+		visits += result.root_moves[i].visits;
+		if (i > 0) {
+			CHECK(result.root_moves[i - 1].visits >= result.root_moves[i].visits);
+		}
+	}
+	CHECK(visits == result.games_played);
+	CHECK(result.games_played == 2000);
+	CHECK(result.statistics.number_of_threads == 2);
+	CHECK(result.statistics.iterations == 2000);
+	CHECK(result.statistics.nodes == 2002);
+	CHECK(result.statistics.memory_bytes > 0);
+	CHECK(result.seconds > 0);
+
+	// Playing the principal variation is legal and alternates players.
+	REQUIRE(result.principal_variation.size() >= 2);
+	CHECK(result.principal_variation[0] == result.best_move);
+	NimState state(21);
+	for (auto move: result.principal_variation) {
+		auto moves = state.get_moves();
+		CHECK(std::find(moves.begin(), moves.end(), move) != moves.end());
+		state.do_move(move);
+	}
+
+	// A single legal move is returned without searching.
+	auto single = MCTS::compute_search_result(NimState(1), options);
+	CHECK(single.best_move == 1);
+	CHECK(single.root_moves.empty());
+	CHECK(single.games_played == 0);
+	CHECK(single.statistics.number_of_threads == 0);
+	CHECK(single.seconds >= 0);
+	CHECK(single.seconds < result.seconds);
+}
+
+TEST_CASE("multi_pv")
+{
+	MCTS::ComputeOptions options;
+	options.number_of_threads = 2;
+	options.max_iterations = 1000;
+	options.multi_pv = 2;
+	auto result = MCTS::compute_search_result(NimState(21), options);
+	REQUIRE(result.root_moves.size() == 3);
+	for (int i = 0; i < 3; ++i) {
+		auto& root_move = result.root_moves[i];
+		if (i < options.multi_pv) {
+			REQUIRE( ! root_move.variation.empty());
+			CHECK(root_move.variation[0] == root_move.move);
+		}
+		else {
+			CHECK(root_move.variation.empty());
+		}
+	}
+	CHECK(result.games_played == 2000);
+
+	// The principal variation of a single tree follows the most
+	// visited children.
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+	auto variation = MCTS::principal_variation(*tree);
+	REQUIRE( ! variation.empty());
+	CHECK(variation[0] == tree->best_child()->move);
+	const MCTS::Node<NimState>* node = tree.get();
+	for (auto move: variation) {
+		auto child = node->best_child();
+		CHECK(child->move == move);
+		node = child;
+	}
+	CHECK( ! node->has_children());
+	CHECK(MCTS::principal_variation(*tree, 2).size() == 2);
+}
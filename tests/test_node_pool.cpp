@@ -0,0 +1,67 @@
+// Petter Strandmark 2013.
+
+#define CATCH_CONFIG_MAIN
+#include <catch.hpp>
+
+#ifndef MCTS_NODE_POOL
+#define MCTS_NODE_POOL
+#endif
+#include <mcts.h>
+
+#include <cstring>
+#include <thread>
+
+#include "games/nim.h"
+
+using namespace std;
+
+TEST_CASE("node_pool")
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = 1000;
+	auto chunks = MCTS::NodeMemory::number_of_chunks();
+	auto tree = MCTS::compute_tree(NimState(21), options, 1);
+	auto tree_visits = tree->visits;
+	// Nodes are placed on the NUMA node of the allocating thread.
+	CHECK(MCTS::NodeMemory::numa_node_of(tree.get()) == MCTS::NodeMemory::current_numa_node());
+	tree.reset();
+
+	// The freed nodes are reused for the next tree.
+	auto chunks_after_first_tree = MCTS::NodeMemory::number_of_chunks();
+	CHECK(chunks_after_first_tree <= chunks + 1);
+	tree = MCTS::compute_tree(NimState(21), options, 1);
+	CHECK(MCTS::NodeMemory::number_of_chunks() == chunks_after_first_tree);
+	CHECK(tree->visits == tree_visits);
+	tree.reset();
+
+	// The chunks of a large tree are returned when it is destroyed,
+	// also by another thread.
+	options.max_iterations = 100000;
+	tree = MCTS::compute_tree(NimState(21), options, 1);
+	CHECK(MCTS::NodeMemory::number_of_chunks() > chunks_after_first_tree + 2);
+	tree.reset();
+	CHECK(MCTS::NodeMemory::number_of_chunks() <= chunks_after_first_tree);
+	tree = MCTS::compute_tree(NimState(21), options, 1);
+	auto released_tree = tree.release();
+	std::thread([released_tree] () { delete released_tree; }).join();
+	CHECK(MCTS::NodeMemory::number_of_chunks() <= chunks_after_first_tree);
+
+	// The chunks of search threads are returned when they finish.
+	options.number_of_threads = 2;
+	options.max_iterations = 10000;
+	CHECK(MCTS::compute_move(NimState(21), options) == 1);
+	CHECK(MCTS::NodeMemory::number_of_chunks() <= chunks_after_first_tree);
+
+	// Falls back to ordinary pages if huge pages are not available.
+	MCTS::NodeMemory::use_huge_pages(true);
+	auto chunk = MCTS::NodeMemory::allocate_chunk();
+	CHECK(chunk);
+	CHECK((reinterpret_cast<std::uintptr_t>(chunk) % MCTS::NodeMemory::chunk_size) == 0);
+	CHECK(MCTS::NodeMemory::numa_node_of(reinterpret_cast<char*>(chunk) + 12345) == MCTS::NodeMemory::current_numa_node());
+	std::memset(reinterpret_cast<char*>(chunk) + MCTS::NodeMemory::header_size, 1,
+	            MCTS::NodeMemory::chunk_size - MCTS::NodeMemory::header_size);
+	MCTS::NodeMemory::use_huge_pages(false);
+	CHECK(MCTS::NodeMemory::number_of_huge_page_chunks() <= MCTS::NodeMemory::number_of_chunks());
+	MCTS::NodeMemory::free_chunk(chunk);
+	CHECK(MCTS::NodeMemory::number_of_chunks() <= chunks_after_first_tree);
+}
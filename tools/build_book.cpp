@@ -0,0 +1,120 @@
+// Petter Strandmark 2013
+// petter.strandmark@gmail.com
+//
+// Builds an opening book by searching from the start position of a
+// game with several independent searches in parallel. The first plies
+// of all trees are written to the book.
+//
+// Usage: build_book GAME FILE [--plies K] [--iterations N] [--threads T]
+//                             [--minimum-visits V]
+//
+// GAME is one of nim, connect_four, kalaha and go.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <mcts.h>
+
+#include "games/connect_four.h"
+#include "games/go.h"
+#include "games/kalaha.h"
+#include "games/nim.h"
+
+template<typename State>
+void build_book(const State& start_state,
+                const string& file_name,
+                int plies,
+                int iterations,
+                int threads,
+                long long minimum_visits)
+{
+	MCTS::ComputeOptions options;
+	options.max_iterations = iterations;
+
+	vector<future<unique_ptr<MCTS::Node<State>>>> root_futures;
+	for (int t = 0; t < threads; ++t) {
+		auto func = [t, &start_state, &options] () -> unique_ptr<MCTS::Node<State>>
+		{
+			return MCTS::compute_tree(start_state, options, 1012411 * t + 12515);
+		};
+		root_futures.push_back(std::async(std::launch::async, func));
+	}
+
+	MCTS::OpeningBookBuilder builder;
+	for (int t = 0; t < threads; ++t) {
+		auto root = root_futures[t].get();
+		builder.add_tree(*root, start_state, plies, minimum_visits);
+	}
+	builder.write(file_name);
+	cerr << builder.size() << " moves written to " << file_name << "." << endl;
+}
+
+int main_program(int argc, char* argv[])
+{
+	if (argc < 3) {
+		cerr << "Usage: " << argv[0] << " GAME FILE [--plies K] [--iterations N] [--threads T] [--minimum-visits V]" << endl;
+		return 1;
+	}
+	string game = argv[1];
+	string file_name = argv[2];
+
+	int plies = 4;
+	int iterations = 1000000;
+	int threads = 8;
+	long long minimum_visits = 100;
+	for (int i = 3; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "--plies") == 0) {
+			plies = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--iterations") == 0) {
+			iterations = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0) {
+			threads = std::atoi(argv[i + 1]);
+		}
+		else if (std::strcmp(argv[i], "--minimum-visits") == 0) {
+			minimum_visits = std::atoll(argv[i + 1]);
+		}
+		else {
+			cerr << "Unknown option " << argv[i] << "." << endl;
+			return 1;
+		}
+	}
+	attest(plies >= 1 && iterations >= 1 && threads >= 1);
+
+	if (game == "nim") {
+		build_book(NimState(21), file_name, plies, iterations, threads, minimum_visits);
+	}
+	else if (game == "connect_four") {
+		build_book(ConnectFourState(), file_name, plies, iterations, threads, minimum_visits);
+	}
+	else if (game == "kalaha") {
+		build_book(KalahaState<6>(3), file_name, plies, iterations, threads, minimum_visits);
+	}
+	else if (game == "go") {
+		build_book(GoState<9, 9>(), file_name, plies, iterations, threads, minimum_visits);
+	}
+	else {
+		cerr << "Unknown game " << game << "." << endl;
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		return main_program(argc, argv);
+	}
+	catch (std::runtime_error& error) {
+		std::cerr << "ERROR: " << error.what() << std::endl;
+		return 1;
+	}
+}